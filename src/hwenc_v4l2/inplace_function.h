@@ -0,0 +1,114 @@
+#ifndef INPLACE_FUNCTION_H_
+#define INPLACE_FUNCTION_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 呼び出し可能なオブジェクトを内部のバッファに直接保持する std::function。
+// フレーム毎に積むコールバックでヒープ確保をしないために使う。
+// Capacity を超える大きさのオブジェクトはコンパイルエラーになる。
+template <class Signature, size_t Capacity>
+class InplaceFunction;
+
+template <class R, class... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+ public:
+  InplaceFunction() = default;
+  InplaceFunction(std::nullptr_t) {}
+
+  template <class F,
+            class = std::enable_if_t<
+                !std::is_same_v<std::decay_t<F>, InplaceFunction> &&
+                std::is_invocable_r_v<R, std::decay_t<F>&, Args...>>>
+  InplaceFunction(F&& f) {
+    using T = std::decay_t<F>;
+    static_assert(sizeof(T) <= Capacity,
+                  "The callable is too large for InplaceFunction");
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "The callable is over-aligned for InplaceFunction");
+    new (&storage_) T(std::forward<F>(f));
+    invoke_ = [](void* p, Args... args) -> R {
+      return (*static_cast<T*>(p))(std::forward<Args>(args)...);
+    };
+    manage_ = [](Operation op, void* dst, void* src) {
+      switch (op) {
+        case Operation::kCopy:
+          new (dst) T(*static_cast<const T*>(src));
+          break;
+        case Operation::kMove:
+          new (dst) T(std::move(*static_cast<T*>(src)));
+          static_cast<T*>(src)->~T();
+          break;
+        case Operation::kDestroy:
+          static_cast<T*>(dst)->~T();
+          break;
+      }
+    };
+  }
+
+  InplaceFunction(const InplaceFunction& other) { CopyFrom(other); }
+  InplaceFunction(InplaceFunction&& other) noexcept {
+    MoveFrom(std::move(other));
+  }
+  InplaceFunction& operator=(const InplaceFunction& other) {
+    if (this != &other) {
+      Reset();
+      CopyFrom(other);
+    }
+    return *this;
+  }
+  InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      MoveFrom(std::move(other));
+    }
+    return *this;
+  }
+  InplaceFunction& operator=(std::nullptr_t) {
+    Reset();
+    return *this;
+  }
+  ~InplaceFunction() { Reset(); }
+
+  explicit operator bool() const { return invoke_ != nullptr; }
+
+  // std::function と同様に、const なオブジェクトからも呼び出せるようにする
+  R operator()(Args... args) const {
+    return invoke_(&storage_, std::forward<Args>(args)...);
+  }
+
+ private:
+  enum class Operation { kCopy, kMove, kDestroy };
+
+  void CopyFrom(const InplaceFunction& other) {
+    if (other.manage_ != nullptr) {
+      other.manage_(Operation::kCopy, &storage_, &other.storage_);
+    }
+    invoke_ = other.invoke_;
+    manage_ = other.manage_;
+  }
+  void MoveFrom(InplaceFunction&& other) {
+    if (other.manage_ != nullptr) {
+      other.manage_(Operation::kMove, &storage_, &other.storage_);
+    }
+    invoke_ = other.invoke_;
+    manage_ = other.manage_;
+    other.invoke_ = nullptr;
+    other.manage_ = nullptr;
+  }
+  void Reset() {
+    if (manage_ != nullptr) {
+      manage_(Operation::kDestroy, &storage_, nullptr);
+    }
+    invoke_ = nullptr;
+    manage_ = nullptr;
+  }
+
+  alignas(std::max_align_t) mutable unsigned char storage_[Capacity];
+  R (*invoke_)(void*, Args...) = nullptr;
+  void (*manage_)(Operation, void*, void*) = nullptr;
+};
+
+#endif
@@ -279,7 +279,18 @@ void LibcameraCapturer::requestComplete(libcamerac_Request* request) {
   int height = libcamerac_StreamConfiguration_get_size_height(cfg);
   int stride = libcamerac_StreamConfiguration_get_stride(cfg);
 
-  const int64_t timestamp_us = rtc::TimeMicros();
+  // センサーの露光時刻をフレームのタイムスタンプにする
+  int64_t capture_time_us = -1;
+  int64_t sensor_timestamp_ns;
+  if (libcamerac_ControlList_get_SensorTimestamp(
+          libcamerac_Request_metadata(request), &sensor_timestamp_ns)) {
+    const int64_t sensor_timestamp_us =
+        sensor_timestamp_ns / rtc::kNumNanosecsPerMicrosec;
+    if (sensor_timestamp_us > 0 && sensor_timestamp_us <= rtc::TimeMicros()) {
+      capture_time_us = sensor_timestamp_us;
+    }
+  }
+  const int64_t timestamp_us = ToCaptureTimestampUs(capture_time_us);
   int adapted_width, adapted_height, crop_width, crop_height, crop_x, crop_y;
   if (!AdaptFrame(width, height, timestamp_us, &adapted_width, &adapted_height,
                   &crop_width, &crop_height, &crop_x, &crop_y)) {
@@ -320,7 +331,7 @@ void LibcameraCapturer::requestComplete(libcamerac_Request* request) {
     webrtc::VideoFrame video_frame = webrtc::VideoFrame::Builder()
                                          .set_video_frame_buffer(frame_buffer)
                                          .set_timestamp_rtp(0)
-                                         .set_timestamp_us(rtc::TimeMicros())
+                                         .set_timestamp_us(timestamp_us)
                                          .set_rotation(webrtc::kVideoRotation_0)
                                          .build();
     OnFrame(video_frame);
@@ -341,7 +352,7 @@ void LibcameraCapturer::requestComplete(libcamerac_Request* request) {
     webrtc::VideoFrame video_frame = webrtc::VideoFrame::Builder()
                                          .set_video_frame_buffer(frame_buffer)
                                          .set_timestamp_rtp(0)
-                                         .set_timestamp_us(rtc::TimeMicros())
+                                         .set_timestamp_us(timestamp_us)
                                          .set_rotation(webrtc::kVideoRotation_0)
                                          .build();
     OnFrame(video_frame);
@@ -19,8 +19,8 @@ struct LibcameraCapturerConfig : sora::V4L2VideoCapturerConfig {
   }
   // native_frame_output == true の場合、キャプチャしたデータを kNative なフレームとして渡す。
   // native_frame_output == false の場合、データをコピーして I420Buffer なフレームを作って渡す。
-  // 前者の方が効率が良いけれども、kNative なフレームはサイマルキャスト時に自動で
-  // リサイズしてくれないので、状況に応じて使い分けるのが良い。
+  // 前者の方が効率が良い。kNative なフレームもサイマルキャスト時のリサイズや
+  // ソフトウェアエンコーダでのエンコードが必要な場合は、fd を mmap して CPU で I420 に変換する。
   bool native_frame_output = false;
 };
 
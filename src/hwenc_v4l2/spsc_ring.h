@@ -0,0 +1,61 @@
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+// 1 つのスレッドから push し、別の 1 つのスレッドから pop する固定長のリングバッファ。
+// ロックは取らずに、読み込み位置と書き込み位置の atomic だけで同期する。
+// push は満杯の場合に false を返す。
+template <class T, size_t Capacity>
+class SpscRing {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+ public:
+  static constexpr size_t capacity() { return Capacity; }
+
+  // 書き込み側のスレッドから呼ぶ
+  bool push(T t) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    slots_[tail & (Capacity - 1)] = std::move(t);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 読み込み側のスレッドから呼ぶ
+  std::optional<T> pop() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    T& slot = slots_[head & (Capacity - 1)];
+    std::optional<T> t(std::move(slot));
+    // キャプチャしているバッファ等をすぐに解放するために空にしておく
+    slot = T();
+    head_.store(head + 1, std::memory_order_release);
+    return t;
+  }
+
+  // どのスレッドからも呼べるが、他のスレッドが操作している間は目安の値になる
+  size_t size() const {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return tail - head;
+  }
+  bool empty() const { return size() == 0; }
+
+ private:
+  // 書き込み側と読み込み側で別のキャッシュラインに置く
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  std::array<T, Capacity> slots_{};
+};
+
+#endif
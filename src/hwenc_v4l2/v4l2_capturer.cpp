@@ -69,8 +69,9 @@ rtc::scoped_refptr<sora::V4L2VideoCapturer> V4L2Capturer::Create(
   return v4l2_capturer;
 }
 
-void V4L2Capturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
-  const int64_t timestamp_us = rtc::TimeMicros();
+void V4L2Capturer::OnCaptured(uint8_t* data,
+                              uint32_t bytesused,
+                              int64_t timestamp_us) {
   int adapted_width, adapted_height, crop_width, crop_height, crop_x, crop_y;
   if (!AdaptFrame(_currentWidth, _currentHeight, timestamp_us, &adapted_width,
                   &adapted_height, &crop_width, &crop_height, &crop_x,
@@ -82,12 +83,13 @@ void V4L2Capturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
       webrtc::VideoType::kMJPEG, _currentWidth, _currentHeight, adapted_width,
       adapted_height, 0, data, bytesused, _currentWidth, nullptr);
 
-  webrtc::VideoFrame video_frame = webrtc::VideoFrame::Builder()
-                                       .set_video_frame_buffer(frame_buffer)
-                                       .set_timestamp_rtp(0)
-                                       .set_timestamp_ms(rtc::TimeMillis())
-                                       .set_timestamp_us(rtc::TimeMicros())
-                                       .set_rotation(webrtc::kVideoRotation_0)
-                                       .build();
+  webrtc::VideoFrame video_frame =
+      webrtc::VideoFrame::Builder()
+          .set_video_frame_buffer(frame_buffer)
+          .set_timestamp_rtp(0)
+          .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+          .set_timestamp_us(timestamp_us)
+          .set_rotation(webrtc::kVideoRotation_0)
+          .build();
   OnFrame(video_frame);
 }
\ No newline at end of file
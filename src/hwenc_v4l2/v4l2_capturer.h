@@ -15,7 +15,9 @@ class V4L2Capturer : public sora::V4L2VideoCapturer {
       sora::V4L2VideoCapturerConfig config,
       size_t capture_device_index);
 
-  void OnCaptured(uint8_t* data, uint32_t bytesused) override;
+  void OnCaptured(uint8_t* data,
+                  uint32_t bytesused,
+                  int64_t timestamp_us) override;
 };
 
 #endif  // NVCODEC_V4L2_CAPTURER_H_
@@ -188,6 +188,9 @@ int V4L2H264EncodeConverter::Encode(
 
     runner_ = V4L2Runner::Create("H264Encoder", fd_, src_buffers_.count(),
                                  src_buffers_.memory(), V4L2_MEMORY_MMAP);
+    if (!runner_) {
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
   }
 
   std::optional<int> index = runner_->PopAvailableBufferIndex();
@@ -238,8 +241,9 @@ int V4L2H264EncodeConverter::Encode(
   }
 
   runner_->Enqueue(
-      &v4l2_buf, [this, bind_buffer, on_complete](
-                     v4l2_buffer* v4l2_buf, std::function<void()> on_next) {
+      &v4l2_buf,
+      [this, bind_buffer, on_complete](v4l2_buffer* v4l2_buf,
+                                       V4L2Runner::OnNextCallback on_next) {
         int64_t timestamp_us =
             v4l2_buf->timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
             v4l2_buf->timestamp.tv_usec;
@@ -374,6 +378,9 @@ int V4L2ScaleConverter::Init(int src_memory,
 
   runner_ = V4L2Runner::Create("Scaler", fd_, src_buffers_.count(), src_memory,
                                V4L2_MEMORY_MMAP);
+  if (!runner_) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
 
   return WEBRTC_VIDEO_CODEC_OK;
 }
@@ -430,8 +437,9 @@ int V4L2ScaleConverter::Scale(
   }
 
   runner_->Enqueue(
-      &v4l2_buf, [this, bind_buffer, on_complete](
-                     v4l2_buffer* v4l2_buf, std::function<void()> on_next) {
+      &v4l2_buf,
+      [this, bind_buffer, on_complete](v4l2_buffer* v4l2_buf,
+                                       V4L2Runner::OnNextCallback on_next) {
         int64_t timestamp_us =
             v4l2_buf->timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
             v4l2_buf->timestamp.tv_usec;
@@ -598,6 +606,9 @@ int V4L2DecodeConverter::Init(int src_pixelformat, bool dst_export_dmafds) {
 
         RTC_LOG(LS_INFO) << "Ready to decode capture stream";
       });
+  if (!runner_) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
 
   return WEBRTC_VIDEO_CODEC_OK;
 }
@@ -689,7 +700,7 @@ int V4L2DecodeConverter::Decode(const uint8_t* data,
 
   runner_->Enqueue(
       &v4l2_buf, [this, on_complete](v4l2_buffer* v4l2_buf,
-                                     std::function<void()> on_next) {
+                                     V4L2Runner::OnNextCallback on_next) {
         int64_t timestamp_rtp =
             v4l2_buf->timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
             v4l2_buf->timestamp.tv_usec;
@@ -1,7 +1,65 @@
 #include "v4l2_native_buffer.h"
 
+#include <errno.h>
+#include <linux/dma-buf.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
 // WebRTC
+#include <api/video/i420_buffer.h>
 #include <rtc_base/logging.h>
+#include <third_party/libyuv/include/libyuv.h>
+
+namespace {
+
+// dmabuf を読み込み用に mmap する。
+// CPU から読む前後に DMA_BUF_IOCTL_SYNC でキャッシュを同期する。
+class ScopedDmaBufMapping {
+ public:
+  ScopedDmaBufMapping(int fd, int size) : fd_(fd), size_(size) {
+    void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+      RTC_LOG(LS_ERROR) << "Failed to mmap dmabuf: fd=" << fd_
+                        << " size=" << size_ << " errno=" << errno;
+      return;
+    }
+    data_ = static_cast<const uint8_t*>(p);
+    Sync(DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+  }
+  ~ScopedDmaBufMapping() {
+    if (data_ == nullptr) {
+      return;
+    }
+    Sync(DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+  ScopedDmaBufMapping(const ScopedDmaBufMapping&) = delete;
+  ScopedDmaBufMapping& operator=(const ScopedDmaBufMapping&) = delete;
+
+  const uint8_t* data() const { return data_; }
+
+ private:
+  void Sync(uint64_t flags) {
+    dma_buf_sync sync = {};
+    sync.flags = flags;
+    int r;
+    do {
+      r = ioctl(fd_, DMA_BUF_IOCTL_SYNC, &sync);
+    } while (r < 0 && (errno == EINTR || errno == EAGAIN));
+    // memfd 等の dmabuf でない fd の場合は ENOTTY になるけど、同期の必要も無いので無視する
+    if (r < 0 && errno != ENOTTY) {
+      RTC_LOG(LS_WARNING) << "Failed to DMA_BUF_IOCTL_SYNC: fd=" << fd_
+                          << " errno=" << errno;
+    }
+  }
+
+  int fd_;
+  int size_;
+  const uint8_t* data_ = nullptr;
+};
+
+}  // namespace
 
 V4L2NativeBuffer::V4L2NativeBuffer(webrtc::VideoType video_type,
                                    int raw_width,
@@ -16,11 +74,16 @@ V4L2NativeBuffer::V4L2NativeBuffer(webrtc::VideoType video_type,
     : video_type_(video_type),
       raw_width_(raw_width),
       raw_height_(raw_height),
+      offset_x_(0),
+      offset_y_(0),
+      crop_width_(raw_width),
+      crop_height_(raw_height),
       scaled_width_(scaled_width),
       scaled_height_(scaled_height),
       fd_(fd),
       size_(size),
-      stride_(stride) {
+      stride_(stride),
+      raw_i420_cache_(std::make_shared<RawI420Cache>()) {
   if (data != nullptr) {
     data_.reset(new uint8_t[size_]);
     memcpy(data_.get(), data, size_);
@@ -41,16 +104,53 @@ V4L2NativeBuffer::V4L2NativeBuffer(webrtc::VideoType video_type,
                                    int size,
                                    int stride,
                                    std::shared_ptr<void> shared_on_destruction)
+    : V4L2NativeBuffer(video_type,
+                       raw_width,
+                       raw_height,
+                       0,
+                       0,
+                       raw_width,
+                       raw_height,
+                       scaled_width,
+                       scaled_height,
+                       fd,
+                       data,
+                       size,
+                       stride,
+                       shared_on_destruction,
+                       std::make_shared<RawI420Cache>()) {}
+
+V4L2NativeBuffer::V4L2NativeBuffer(
+    webrtc::VideoType video_type,
+    int raw_width,
+    int raw_height,
+    int offset_x,
+    int offset_y,
+    int crop_width,
+    int crop_height,
+    int scaled_width,
+    int scaled_height,
+    int fd,
+    const std::shared_ptr<uint8_t> data,
+    int size,
+    int stride,
+    std::shared_ptr<void> shared_on_destruction,
+    std::shared_ptr<RawI420Cache> raw_i420_cache)
     : video_type_(video_type),
       raw_width_(raw_width),
       raw_height_(raw_height),
+      offset_x_(offset_x),
+      offset_y_(offset_y),
+      crop_width_(crop_width),
+      crop_height_(crop_height),
       scaled_width_(scaled_width),
       scaled_height_(scaled_height),
       fd_(fd),
       data_(data),
       size_(size),
       stride_(stride),
-      shared_on_destruction_(shared_on_destruction) {}
+      shared_on_destruction_(shared_on_destruction),
+      raw_i420_cache_(std::move(raw_i420_cache)) {}
 
 webrtc::VideoFrameBuffer::Type V4L2NativeBuffer::type() const {
   return webrtc::VideoFrameBuffer::Type::kNative;
@@ -62,11 +162,95 @@ int V4L2NativeBuffer::height() const {
   return scaled_height_;
 }
 rtc::scoped_refptr<webrtc::I420BufferInterface> V4L2NativeBuffer::ToI420() {
-  RTC_LOG(LS_ERROR) << "V4L2NativeBuffer::ToI420() not implemented";
-  return nullptr;
+  bool cropped = offset_x_ != 0 || offset_y_ != 0 ||
+                 crop_width_ != raw_width_ || crop_height_ != raw_height_;
+  bool scaled = scaled_width_ != crop_width_ || scaled_height_ != crop_height_;
+
+  if (video_type_ != webrtc::VideoType::kI420) {
+    // MJPEG 等は一度フルサイズの I420 に変換してから crop と縮小を行う
+    rtc::scoped_refptr<webrtc::I420BufferInterface> raw = GetRawI420();
+    if (raw == nullptr || (!cropped && !scaled)) {
+      return raw;
+    }
+    rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+        webrtc::I420Buffer::Create(scaled_width_, scaled_height_);
+    buffer->CropAndScaleFrom(*raw, offset_x_, offset_y_, crop_width_,
+                             crop_height_);
+    return buffer;
+  }
+
+  // I420 の場合はコピーせずに、元のバッファから直接 crop と縮小を行う
+  std::unique_ptr<ScopedDmaBufMapping> mapping;
+  const uint8_t* data = data_.get();
+  if (data == nullptr) {
+    if (fd_ < 0) {
+      RTC_LOG(LS_ERROR) << "V4L2NativeBuffer has neither data nor fd";
+      return nullptr;
+    }
+    mapping.reset(new ScopedDmaBufMapping(fd_, size_));
+    data = mapping->data();
+    if (data == nullptr) {
+      return nullptr;
+    }
+  }
+  int chroma_stride = (stride_ + 1) / 2;
+  int chroma_height = (raw_height_ + 1) / 2;
+  if (size_ < stride_ * raw_height_ + chroma_stride * chroma_height * 2) {
+    RTC_LOG(LS_ERROR) << "V4L2NativeBuffer is too small: size=" << size_
+                      << " stride=" << stride_ << " height=" << raw_height_;
+    return nullptr;
+  }
+  const uint8_t* src_y = data;
+  const uint8_t* src_u = src_y + stride_ * raw_height_;
+  const uint8_t* src_v = src_u + chroma_stride * chroma_height;
+  // mapping が生きている間だけ使う
+  rtc::scoped_refptr<webrtc::I420BufferInterface> src = webrtc::WrapI420Buffer(
+      raw_width_, raw_height_, src_y, stride_, src_u, chroma_stride, src_v,
+      chroma_stride, []() {});
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      webrtc::I420Buffer::Create(scaled_width_, scaled_height_);
+  buffer->CropAndScaleFrom(*src, offset_x_, offset_y_, crop_width_,
+                           crop_height_);
+  return buffer;
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface>
+V4L2NativeBuffer::GetRawI420() {
+  // 最初に呼んだスレッドが変換し、他のスレッドはその結果を待って使う
+  webrtc::MutexLock lock(&raw_i420_cache_->mutex);
+  if (raw_i420_cache_->buffer != nullptr) {
+    return raw_i420_cache_->buffer;
+  }
+  if (data_ != nullptr) {
+    raw_i420_cache_->buffer = ConvertRawI420(data_.get());
+  } else if (fd_ >= 0) {
+    ScopedDmaBufMapping mapping(fd_, size_);
+    if (mapping.data() != nullptr) {
+      raw_i420_cache_->buffer = ConvertRawI420(mapping.data());
+    }
+  } else {
+    RTC_LOG(LS_ERROR) << "V4L2NativeBuffer has neither data nor fd";
+  }
+  return raw_i420_cache_->buffer;
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface>
+V4L2NativeBuffer::ConvertRawI420(const uint8_t* data) {
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      webrtc::I420Buffer::Create(raw_width_, raw_height_);
+  if (libyuv::ConvertToI420(
+          data, size_, buffer->MutableDataY(), buffer->StrideY(),
+          buffer->MutableDataU(), buffer->StrideU(), buffer->MutableDataV(),
+          buffer->StrideV(), 0, 0, raw_width_, raw_height_, raw_width_,
+          raw_height_, libyuv::kRotate0,
+          webrtc::ConvertVideoType(video_type_)) != 0) {
+    RTC_LOG(LS_ERROR) << "Failed to convert V4L2NativeBuffer to I420: type="
+                      << static_cast<int>(video_type_);
+    return nullptr;
+  }
+  return buffer;
 }
 
-// crop は無視してサイズだけ変更する
 rtc::scoped_refptr<webrtc::VideoFrameBuffer> V4L2NativeBuffer::CropAndScale(
     int offset_x,
     int offset_y,
@@ -74,9 +258,15 @@ rtc::scoped_refptr<webrtc::VideoFrameBuffer> V4L2NativeBuffer::CropAndScale(
     int crop_height,
     int scaled_width,
     int scaled_height) {
+  // offset と crop は現在のサイズ (width x height) での値なので、raw の座標に直す
+  int raw_offset_x = offset_x_ + offset_x * crop_width_ / scaled_width_;
+  int raw_offset_y = offset_y_ + offset_y * crop_height_ / scaled_height_;
+  int raw_crop_width = crop_width * crop_width_ / scaled_width_;
+  int raw_crop_height = crop_height * crop_height_ / scaled_height_;
   return rtc::make_ref_counted<V4L2NativeBuffer>(
-      video_type_, raw_width_, raw_height_, scaled_width, scaled_height, fd_,
-      data_, size_, stride_, shared_on_destruction_);
+      video_type_, raw_width_, raw_height_, raw_offset_x, raw_offset_y,
+      raw_crop_width, raw_crop_height, scaled_width, scaled_height, fd_, data_,
+      size_, stride_, shared_on_destruction_, raw_i420_cache_);
 }
 
 webrtc::VideoType V4L2NativeBuffer::video_type() const {
@@ -100,3 +290,15 @@ int V4L2NativeBuffer::raw_width() const {
 int V4L2NativeBuffer::raw_height() const {
   return raw_height_;
 }
+int V4L2NativeBuffer::offset_x() const {
+  return offset_x_;
+}
+int V4L2NativeBuffer::offset_y() const {
+  return offset_y_;
+}
+int V4L2NativeBuffer::crop_width() const {
+  return crop_width_;
+}
+int V4L2NativeBuffer::crop_height() const {
+  return crop_height_;
+}
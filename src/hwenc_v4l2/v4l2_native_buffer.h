@@ -2,12 +2,15 @@
 #define V4L2_NATIVE_BUFFER_H_
 
 #include <functional>
+#include <memory>
 
 // WebRTC
 #include <api/scoped_refptr.h>
 #include <api/video/video_frame_buffer.h>
 #include <common_video/include/video_frame_buffer.h>
 #include <common_video/libyuv/include/webrtc_libyuv.h>
+#include <rtc_base/synchronization/mutex.h>
+#include <rtc_base/thread_annotations.h>
 
 class V4L2NativeBuffer : public webrtc::VideoFrameBuffer {
  public:
@@ -36,9 +39,12 @@ class V4L2NativeBuffer : public webrtc::VideoFrameBuffer {
   webrtc::VideoFrameBuffer::Type type() const override;
   int width() const override;
   int height() const override;
+  // data があればそれを、無ければ fd を mmap して CPU で I420 に変換する。
+  // crop が指定されている場合は crop した範囲を scaled_width x scaled_height に縮小する。
   rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override;
 
-  // crop は無視してサイズだけ変更する
+  // バッファは共有したまま crop とサイズだけ変更する。
+  // ハードウェアのスケーラは crop に対応していないので、crop が使われるのは ToI420 の時だけ
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> CropAndScale(
       int offset_x,
       int offset_y,
@@ -54,11 +60,49 @@ class V4L2NativeBuffer : public webrtc::VideoFrameBuffer {
   int stride() const;
   int raw_width() const;
   int raw_height() const;
+  // raw_width x raw_height の中で実際に使う範囲
+  int offset_x() const;
+  int offset_y() const;
+  int crop_width() const;
+  int crop_height() const;
+
+ protected:
+  // MJPEG 等を I420 に変換した結果。CropAndScale で作ったバッファ同士で共有して、
+  // サイマルキャストの各レイヤーが ToI420 しても変換は 1 回で済むようにする
+  struct RawI420Cache {
+    webrtc::Mutex mutex;
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer
+        RTC_GUARDED_BY(mutex);
+  };
+
+  V4L2NativeBuffer(webrtc::VideoType video_type,
+                   int raw_width,
+                   int raw_height,
+                   int offset_x,
+                   int offset_y,
+                   int crop_width,
+                   int crop_height,
+                   int scaled_width,
+                   int scaled_height,
+                   int fd,
+                   const std::shared_ptr<uint8_t> data,
+                   int size,
+                   int stride,
+                   std::shared_ptr<void> shared_on_destruction,
+                   std::shared_ptr<RawI420Cache> raw_i420_cache);
 
  private:
+  rtc::scoped_refptr<webrtc::I420BufferInterface> GetRawI420();
+  rtc::scoped_refptr<webrtc::I420BufferInterface> ConvertRawI420(
+      const uint8_t* data);
+
   webrtc::VideoType video_type_;
   int raw_width_;
   int raw_height_;
+  int offset_x_;
+  int offset_y_;
+  int crop_width_;
+  int crop_height_;
   int scaled_width_;
   int scaled_height_;
   int fd_;
@@ -66,6 +110,7 @@ class V4L2NativeBuffer : public webrtc::VideoFrameBuffer {
   int size_;
   int stride_;
   std::shared_ptr<void> shared_on_destruction_;
+  std::shared_ptr<RawI420Cache> raw_i420_cache_;
 };
 
 #endif
@@ -20,6 +20,12 @@ std::shared_ptr<V4L2Runner> V4L2Runner::Create(
     int src_memory,
     int dst_memory,
     std::function<void()> on_change_resolution) {
+  if (src_count > (int)kMaxBuffers) {
+    RTC_LOG(LS_ERROR) << "Too many output buffers: src_count=" << src_count
+                      << " max=" << kMaxBuffers;
+    return nullptr;
+  }
+
   auto p = std::make_shared<V4L2Runner>();
   p->name_ = name;
   p->fd_ = fd;
@@ -37,13 +43,14 @@ std::shared_ptr<V4L2Runner> V4L2Runner::Create(
     p->on_change_resolution_ = on_change_resolution;
   }
 
+  // ポーリングのスレッドも output_buffers_available_ に push するので、スレッドを作る前に積んでおく
+  for (int i = 0; i < src_count; i++) {
+    p->output_buffers_available_.push(i);
+  }
   p->abort_poll_ = false;
   p->thread_ = rtc::PlatformThread::SpawnJoinable(
       [p = p.get()]() { p->PollProcess(); }, "PollThread",
       rtc::ThreadAttributes().SetPriority(rtc::ThreadPriority::kHigh));
-  for (int i = 0; i < src_count; i++) {
-    p->output_buffers_available_.push(i);
-  }
   return p;
 }
 
@@ -54,7 +61,11 @@ int V4L2Runner::Enqueue(v4l2_buffer* v4l2_buf, OnCompleteCallback on_complete) {
                       << strerror(errno);
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
-  on_completes_.push(on_complete);
+  // 同時にキューに積めるのは出力バッファの数までなので、ここで溢れることはない
+  if (!on_completes_.push(std::move(on_complete))) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << "  on_completes_ is full";
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
 
   return WEBRTC_VIDEO_CODEC_OK;
 }
@@ -68,7 +79,8 @@ void V4L2Runner::PollProcess() {
     RTC_LOG(LS_VERBOSE) << "[POLL][" << name_ << "] Start poll";
     pollfd p = {fd_, POLLIN | POLLPRI, 0};
     int ret = poll(&p, 1, 500);
-    if (abort_poll_ && output_buffers_available_.size() == src_count_) {
+    if (abort_poll_ &&
+        output_buffers_available_.size() == (size_t)src_count_) {
       break;
     }
     if (ret == -1) {
@@ -3,9 +3,8 @@
 
 #include <atomic>
 #include <functional>
-#include <mutex>
+#include <memory>
 #include <optional>
-#include <queue>
 #include <string>
 
 // Linux
@@ -14,42 +13,16 @@
 // WebRTC
 #include <rtc_base/platform_thread.h>
 
-template <class T>
-class ConcurrentQueue {
- public:
-  void push(T t) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(t);
-  }
-  std::optional<T> pop() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (queue_.empty()) {
-      return std::nullopt;
-    }
-    T t = queue_.front();
-    queue_.pop();
-    return t;
-  }
-  bool empty() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return queue_.empty();
-  }
-  size_t size() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return queue_.size();
-  }
-  void clear() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_ = std::queue<T>();
-  }
-
- private:
-  std::queue<T> queue_;
-  std::mutex mutex_;
-};
+#include "inplace_function.h"
+#include "spsc_ring.h"
 
+// Enqueue と PopAvailableBufferIndex は 1 つのスレッドから呼ぶこと。
+// キューはそのスレッドとポーリングのスレッドの間の SPSC のリングバッファになっている。
 class V4L2Runner {
  public:
+  // キューに積めるバッファの最大数
+  static constexpr size_t kMaxBuffers = 32;
+
   ~V4L2Runner();
 
   static std::shared_ptr<V4L2Runner> Create(
@@ -60,7 +33,10 @@ class V4L2Runner {
       int dst_memory,
       std::function<void()> on_change_resolution = nullptr);
 
-  typedef std::function<void(v4l2_buffer*, std::function<void()>)>
+  // キャプチャバッファを V4L2 に戻すためのコールバック
+  typedef InplaceFunction<void(), 96> OnNextCallback;
+  // フレーム毎に積むので、ヒープ確保をしないように呼び出し可能なオブジェクトを直接保持する
+  typedef InplaceFunction<void(v4l2_buffer*, OnNextCallback), 64>
       OnCompleteCallback;
 
   int Enqueue(v4l2_buffer* v4l2_buf, OnCompleteCallback on_complete);
@@ -78,8 +54,8 @@ class V4L2Runner {
   int dst_memory_;
   std::function<void()> on_change_resolution_;
 
-  ConcurrentQueue<int> output_buffers_available_;
-  ConcurrentQueue<OnCompleteCallback> on_completes_;
+  SpscRing<int, kMaxBuffers> output_buffers_available_;
+  SpscRing<OnCompleteCallback, kMaxBuffers> on_completes_;
   std::atomic<bool> abort_poll_;
   rtc::PlatformThread thread_;
 };
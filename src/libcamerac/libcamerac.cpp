@@ -279,6 +279,16 @@ void libcamerac_ControlList_copy(const libcamerac_ControlList* p,
                                  libcamerac_ControlList* control_list) {
   *((libcamera::ControlList*)control_list) = *(const libcamera::ControlList*)p;
 }
+int libcamerac_ControlList_get_SensorTimestamp(const libcamerac_ControlList* p,
+                                               int64_t* value) {
+  auto v = ((const libcamera::ControlList*)p)
+               ->get(libcamera::controls::SensorTimestamp);
+  if (!v) {
+    return 0;
+  }
+  *value = *v;
+  return 1;
+}
 
 // libcamerac_Request
 
@@ -313,6 +323,11 @@ const libcamerac_Request_BufferMap* libcamerac_Request_buffers(
 libcamerac_ControlList* libcamerac_Request_controls(libcamerac_Request* p) {
   return (libcamerac_ControlList*)&((libcamera::Request*)p)->controls();
 }
+const libcamerac_ControlList* libcamerac_Request_metadata(
+    const libcamerac_Request* p) {
+  return (const libcamerac_ControlList*)&((const libcamera::Request*)p)
+      ->metadata();
+}
 
 // libcamerac_Request_BufferMap
 
@@ -3,6 +3,8 @@
 
 // libcamera を C API から使うためのヘッダ
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -211,6 +213,11 @@ extern void libcamerac_ControlList_destroy(libcamerac_ControlList* p);
 extern void libcamerac_ControlList_clear(libcamerac_ControlList* p);
 extern void libcamerac_ControlList_copy(const libcamerac_ControlList* p,
                                         libcamerac_ControlList* control_list);
+// controls::SensorTimestamp (ナノ秒, CLOCK_MONOTONIC) を取得する。
+// 値が存在した場合は 1 を、存在しなかった場合は 0 を返す。
+extern int libcamerac_ControlList_get_SensorTimestamp(
+    const libcamerac_ControlList* p,
+    int64_t* value);
 
 // libcamerac_Request
 
@@ -228,6 +235,8 @@ extern const libcamerac_Request_BufferMap* libcamerac_Request_buffers(
     const libcamerac_Request* p);
 extern libcamerac_ControlList* libcamerac_Request_controls(
     libcamerac_Request* p);
+extern const libcamerac_ControlList* libcamerac_Request_metadata(
+    const libcamerac_Request* p);
 
 // libcamerac_Request_BufferMap
 
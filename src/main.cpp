@@ -149,6 +149,9 @@ int main(int argc, char* argv[]) {
     v4l2_config.framerate = args.framerate;
     v4l2_config.force_i420 = args.force_i420;
     v4l2_config.use_native = args.hw_mjpeg_decoder;
+    v4l2_config.buffer_count = args.v4l2_buffer_count;
+    v4l2_config.zero_copy = args.v4l2_zero_copy;
+    v4l2_config.mjpeg_decode_threads = args.v4l2_mjpeg_decode_threads;
 
 #if defined(USE_JETSON_ENCODER)
     if (v4l2_config.use_native) {
@@ -167,11 +170,9 @@ int main(int argc, char* argv[]) {
 #elif defined(USE_V4L2_ENCODER)
     if (args.use_libcamera) {
       LibcameraCapturerConfig libcamera_config = v4l2_config;
-      // use_libcamera_native == true でも、サイマルキャストの場合はネイティブフレームを出力しない
-      libcamera_config.native_frame_output =
-          args.use_libcamera_native && !(use_sora && args.sora_simulcast);
+      libcamera_config.native_frame_output = args.use_libcamera_native;
       return LibcameraCapturer::Create(libcamera_config);
-    } else if (v4l2_config.use_native && !(use_sora && args.sora_simulcast)) {
+    } else if (v4l2_config.use_native) {
       return V4L2Capturer::Create(std::move(v4l2_config));
     } else {
       return sora::V4L2VideoCapturer::Create(std::move(v4l2_config));
@@ -199,6 +200,7 @@ int main(int argc, char* argv[]) {
 
   rtcm_config.fixed_resolution = args.fixed_resolution;
   rtcm_config.simulcast = args.sora_simulcast;
+  rtcm_config.simulcast_parallel_encode = args.sora_simulcast_parallel_encode;
   rtcm_config.hardware_encoder_only = args.hw_mjpeg_decoder;
 
   rtcm_config.disable_echo_cancellation = args.disable_echo_cancellation;
@@ -218,10 +220,12 @@ int main(int argc, char* argv[]) {
   rtcm_config.h265_decoder = args.h265_decoder;
 
   rtcm_config.openh264 = args.openh264;
+  rtcm_config.openh264_threads = args.openh264_threads;
   if (!rtcm_config.openh264.empty()) {
     // openh264 が指定されている場合は自動的に H264 ソフトウェアエンコーダを利用する
     rtcm_config.h264_encoder = VideoCodecInfo::Type::Software;
   }
+  rtcm_config.vpl_async_depth = args.vpl_async_depth;
 
   rtcm_config.priority = args.priority;
 
@@ -232,6 +236,7 @@ int main(int argc, char* argv[]) {
   rtcm_config.proxy_url = args.proxy_url;
   rtcm_config.proxy_username = args.proxy_username;
   rtcm_config.proxy_password = args.proxy_password;
+  rtcm_config.stats_cache_interval_ms = args.stats_cache_interval;
 
   std::unique_ptr<SDLRenderer> sdl_renderer = nullptr;
   if (args.use_sdl) {
@@ -249,8 +254,15 @@ int main(int argc, char* argv[]) {
 
     std::shared_ptr<RTCDataManager> data_manager = nullptr;
     if (!args.serial_device.empty()) {
+      SerialDataManagerConfig serial_config;
+      serial_config.framing = args.serial_framing == "binary"
+                                  ? SerialDataManagerConfig::Framing::Binary
+                                  : SerialDataManagerConfig::Framing::Line;
+      serial_config.batch_max_bytes = args.serial_batch_bytes;
+      serial_config.batch_max_delay_ms = args.serial_batch_delay_ms;
       data_manager = std::shared_ptr<RTCDataManager>(
-          SerialDataManager::Create(ioc, args.serial_device, args.serial_rate)
+          SerialDataManager::Create(ioc, args.serial_device, args.serial_rate,
+                                    serial_config)
               .release());
       if (!data_manager) {
         return 1;
@@ -284,6 +296,9 @@ int main(int argc, char* argv[]) {
       config.role = args.sora_role;
       config.spotlight = args.sora_spotlight;
       config.spotlight_number = args.sora_spotlight_number;
+      config.simulcast_rid = args.sora_simulcast_rid;
+      config.spotlight_focus_rid = args.sora_spotlight_focus_rid;
+      config.spotlight_unfocus_rid = args.sora_spotlight_unfocus_rid;
       config.port = args.sora_port;
       config.simulcast = args.sora_simulcast;
       config.data_channel_signaling = args.sora_data_channel_signaling;
@@ -0,0 +1,21 @@
+#include "frame_timing_sink.h"
+
+// WebRTC
+#include <rtc_base/time_utils.h>
+
+#include "latency_histogram.h"
+
+void FrameTimingSink::OnFrame(const webrtc::VideoFrame& frame) {
+  LatencyMetrics& metrics = LatencyMetrics::Instance();
+  int64_t source_us = rtc::TimeMicros();
+  if (frame.processing_time()) {
+    const auto& processing_time = *frame.processing_time();
+    metrics.CaptureToSource().Add(processing_time.start.us() -
+                                  frame.timestamp_us());
+    metrics.SourceAdapt().Add(
+        (processing_time.finish - processing_time.start).us());
+    source_us = processing_time.finish.us();
+  }
+  // エンコーダ側で OnFrame からの待ち時間を計算するために覚えておく
+  metrics.SourceFrameTimes().Put(frame.timestamp_us(), source_us);
+}
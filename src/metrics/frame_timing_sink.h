@@ -0,0 +1,16 @@
+#ifndef FRAME_TIMING_SINK_H_
+#define FRAME_TIMING_SINK_H_
+
+// WebRTC
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+
+// 送信する映像トラックに追加して、ソースから渡されたフレームの時刻を LatencyMetrics に記録する。
+// ScalableVideoTrackSource は VideoFrame::processing_time() に
+// フレームを受け取った時刻と OnFrame に渡した時刻を設定しているので、それを使う。
+class FrameTimingSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  void OnFrame(const webrtc::VideoFrame& frame) override;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "latency_histogram.h"
+
+#include "prometheus_exposition.h"
+
+void LatencyHistogram::Add(int64_t latency_us) {
+  if (latency_us < 0) {
+    latency_us = 0;
+  }
+  size_t index = kBucketBoundsMs.size();
+  for (size_t i = 0; i < kBucketBoundsMs.size(); i++) {
+    if (latency_us <= kBucketBoundsMs[i] * 1000) {
+      index = i;
+      break;
+    }
+  }
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(latency_us, std::memory_order_relaxed);
+}
+
+boost::json::value LatencyHistogram::ToJson() const {
+  boost::json::array buckets;
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    cumulative += buckets_[i].load(std::memory_order_relaxed);
+    boost::json::value le;
+    if (i < kBucketBoundsMs.size()) {
+      le = kBucketBoundsMs[i];
+    } else {
+      le = "+Inf";
+    }
+    buckets.push_back({{"le_ms", le}, {"count", cumulative}});
+  }
+  return {{"count", count_.load(std::memory_order_relaxed)},
+          {"sum_ms", sum_us_.load(std::memory_order_relaxed) / 1000.0},
+          {"buckets", std::move(buckets)}};
+}
+
+void LatencyHistogram::AppendPrometheus(std::string& out,
+                                        const std::string& name) const {
+  out += "# TYPE " + name + " histogram\n";
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    cumulative += buckets_[i].load(std::memory_order_relaxed);
+    out += name + "_bucket{le=\"";
+    if (i < kBucketBoundsMs.size()) {
+      PrometheusExposition::AppendValue(out, kBucketBoundsMs[i] / 1000.0);
+    } else {
+      out += "+Inf";
+    }
+    out += "\"} ";
+    PrometheusExposition::AppendValue(out, cumulative);
+    out += '\n';
+  }
+  out += name + "_sum ";
+  PrometheusExposition::AppendValue(
+      out, sum_us_.load(std::memory_order_relaxed) / 1000000.0);
+  out += '\n';
+  out += name + "_count ";
+  PrometheusExposition::AppendValue(out,
+                                    count_.load(std::memory_order_relaxed));
+  out += '\n';
+}
+
+void FrameTimestampTable::Put(int64_t key, int64_t time_us) {
+  Slot& slot = slots_[static_cast<uint64_t>(key) % kSize];
+  // 書き込み中に読まれても古い時刻と新しいキーが組み合わさらないように、一度キーを無効にする
+  slot.key.store(-1, std::memory_order_relaxed);
+  slot.time_us.store(time_us, std::memory_order_release);
+  slot.key.store(key, std::memory_order_release);
+}
+
+bool FrameTimestampTable::Get(int64_t key, int64_t* time_us) const {
+  const Slot& slot = slots_[static_cast<uint64_t>(key) % kSize];
+  if (slot.key.load(std::memory_order_acquire) != key) {
+    return false;
+  }
+  int64_t t = slot.time_us.load(std::memory_order_acquire);
+  // 読んでいる間に上書きされていないか確認する
+  if (slot.key.load(std::memory_order_acquire) != key) {
+    return false;
+  }
+  *time_us = t;
+  return true;
+}
+
+LatencyMetrics& LatencyMetrics::Instance() {
+  static LatencyMetrics instance;
+  return instance;
+}
+
+boost::json::value LatencyMetrics::ToJson() const {
+  return {{"capture_to_encode", capture_to_encode_.ToJson()},
+          {"capture_to_encoded", capture_to_encoded_.ToJson()},
+          {"stages",
+           {{"capture_to_source", capture_to_source_.ToJson()},
+            {"source_adapt", source_adapt_.ToJson()},
+            {"source_to_encode", source_to_encode_.ToJson()},
+            {"encode_align", encode_align_.ToJson()},
+            {"encode", encode_.ToJson()},
+            {"packetize", packetize_.ToJson()}}}};
+}
+
+void LatencyMetrics::AppendPrometheus(std::string& out) const {
+  capture_to_encode_.AppendPrometheus(out,
+                                      "momo_capture_to_encode_latency_seconds");
+  capture_to_encoded_.AppendPrometheus(
+      out, "momo_capture_to_encoded_latency_seconds");
+  capture_to_source_.AppendPrometheus(
+      out, "momo_stage_capture_to_source_latency_seconds");
+  source_adapt_.AppendPrometheus(out,
+                                 "momo_stage_source_adapt_latency_seconds");
+  source_to_encode_.AppendPrometheus(
+      out, "momo_stage_source_to_encode_latency_seconds");
+  encode_align_.AppendPrometheus(out,
+                                 "momo_stage_encode_align_latency_seconds");
+  encode_.AppendPrometheus(out, "momo_stage_encode_latency_seconds");
+  packetize_.AppendPrometheus(out, "momo_stage_packetize_latency_seconds");
+}
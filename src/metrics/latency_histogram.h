@@ -0,0 +1,102 @@
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Boost
+#include <boost/json.hpp>
+
+// レイテンシを固定のバケットで集計するヒストグラム。
+// エンコードスレッド等から頻繁に呼ばれるので、ロックは取らずに atomic で集計する。
+class LatencyHistogram {
+ public:
+  // 各バケットの上限（ミリ秒）。最後のバケットはこれ以上の値を全て含む。
+  static constexpr std::array<int64_t, 12> kBucketBoundsMs = {
+      1, 2, 5, 10, 20, 33, 50, 100, 200, 500, 1000, 5000};
+
+  void Add(int64_t latency_us);
+
+  // 累積のバケットを JSON で返す
+  // {"count": 10, "sum_ms": 123.4, "buckets": [{"le_ms": 1, "count": 0}, ...]}
+  boost::json::value ToJson() const;
+  // Prometheus のヒストグラムとして秒単位で追加する
+  // (name_bucket{le="0.001"}, name_sum, name_count)
+  void AppendPrometheus(std::string& out, const std::string& name) const;
+
+ private:
+  std::array<std::atomic<uint64_t>, kBucketBoundsMs.size() + 1> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<int64_t> sum_us_{0};
+};
+
+// フレームのタイムスタンプをキーにして、ある処理段階を通過した時刻を覚えておくためのテーブル。
+// 別のスレッドで動く段階の間で時刻を受け渡すのに使う。
+// 固定サイズでロックは取らないので、キーが衝突した場合や書き込み中に読んだ場合は値を取得できないことがある。
+class FrameTimestampTable {
+ public:
+  static constexpr size_t kSize = 256;
+
+  void Put(int64_t key, int64_t time_us);
+  // key の時刻が記録されていれば true を返す
+  bool Get(int64_t key, int64_t* time_us) const;
+
+ private:
+  struct Slot {
+    std::atomic<int64_t> key{-1};
+    std::atomic<int64_t> time_us{0};
+  };
+  std::array<Slot, kSize> slots_;
+};
+
+// プロセス全体で共有するレイテンシの統計
+//
+// フレームは以下の段階を通過するので、段階毎の時間を記録する。
+//   キャプチャ時刻
+//     -> ScalableVideoTrackSource に渡される (capture_to_source: OnCaptured での変換等)
+//     -> OnFrame でエンコーダ等に渡される (source_adapt: 回転、AdaptFrame、縮小)
+//     -> AlignedEncoderAdapter::Encode が呼ばれる (source_to_encode: エンコードキューでの待ち)
+//     -> エンコーダに渡される (encode_align: AlignedEncoderAdapter での切り抜き)
+//     -> OnEncodedImage が呼ばれる (encode: エンコーダ)
+//     -> OnEncodedImage から戻る (packetize: パケット化と送信キューへの投入)
+class LatencyMetrics {
+ public:
+  static LatencyMetrics& Instance();
+
+  // キャプチャ時刻（カーネルやセンサーのタイムスタンプ）からエンコード開始までの時間
+  LatencyHistogram& CaptureToEncode() { return capture_to_encode_; }
+  // キャプチャ時刻からエンコードが終わって OnEncodedImage が呼ばれるまでの時間
+  LatencyHistogram& CaptureToEncoded() { return capture_to_encoded_; }
+
+  // 段階毎の時間
+  LatencyHistogram& CaptureToSource() { return capture_to_source_; }
+  LatencyHistogram& SourceAdapt() { return source_adapt_; }
+  LatencyHistogram& SourceToEncode() { return source_to_encode_; }
+  LatencyHistogram& EncodeAlign() { return encode_align_; }
+  LatencyHistogram& Encode() { return encode_; }
+  LatencyHistogram& Packetize() { return packetize_; }
+
+  // ソースから OnFrame で渡された時刻。キーはフレームの timestamp_us
+  FrameTimestampTable& SourceFrameTimes() { return source_frame_times_; }
+
+  boost::json::value ToJson() const;
+  void AppendPrometheus(std::string& out) const;
+
+ private:
+  LatencyMetrics() = default;
+
+  LatencyHistogram capture_to_encode_;
+  LatencyHistogram capture_to_encoded_;
+  LatencyHistogram capture_to_source_;
+  LatencyHistogram source_adapt_;
+  LatencyHistogram source_to_encode_;
+  LatencyHistogram encode_align_;
+  LatencyHistogram encode_;
+  LatencyHistogram packetize_;
+  FrameTimestampTable source_frame_times_;
+};
+
+#endif
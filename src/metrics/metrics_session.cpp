@@ -13,7 +13,9 @@
 #include <codecvt>
 #endif
 
+#include "latency_histogram.h"
 #include "momo_version.h"
+#include "prometheus_exposition.h"
 #include "util.h"
 
 MetricsSession::MetricsSession(boost::asio::io_context& ioc,
@@ -58,7 +60,9 @@ void MetricsSession::OnRead(boost::system::error_code ec,
     return MOMO_BOOST_ERROR(ec, "read");
 
   if (req_.method() == boost::beast::http::verb::get) {
-    if (req_.target() == "/metrics") {
+    std::string target(req_.target());
+    std::string path = target.substr(0, target.find('?'));
+    if (path == "/metrics") {
       std::shared_ptr<MetricsSession> self(shared_from_this());
       stats_collector_->GetStats(
           [self](
@@ -68,11 +72,28 @@ void MetricsSession::OnRead(boost::system::error_code ec,
                 {"version", MomoVersion::GetClientName()},
                 {"libwebrtc", MomoVersion::GetLibwebrtcName()},
                 {"environment", MomoVersion::GetEnvironmentName()},
-                {"stats", boost::json::parse(stats)}};
+                {"stats", boost::json::parse(stats)},
+                {"latency", LatencyMetrics::Instance().ToJson()}};
 
             self->SendResponse(
                 CreateOKWithJSON(self->req_, std::move(json_message)));
           });
+    } else if (path == "/metrics/prometheus") {
+      std::shared_ptr<MetricsSession> self(shared_from_this());
+      std::set<std::string> types = PrometheusExposition::ParseTypes(target);
+      stats_collector_->GetStats(
+          [self, types = std::move(types)](
+              const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+            self->SendResponse(CreateOKWithText(
+                self->req_, PrometheusExposition::kContentType,
+                PrometheusExposition::Format(report.get(), types)));
+          });
+    } else if (path == "/metrics/latency") {
+      // 統計情報の取得を待たずに、パイプラインの各段階のレイテンシだけを返す
+      boost::json::value json_message = {
+          {"version", MomoVersion::GetClientName()},
+          {"latency", LatencyMetrics::Instance().ToJson()}};
+      SendResponse(CreateOKWithJSON(req_, std::move(json_message)));
     } else {
       SendResponse(Util::NotFound(req_, req_.target()));
     }
@@ -116,3 +137,19 @@ MetricsSession::CreateOKWithJSON(
 
   return res;
 }
+
+boost::beast::http::response<boost::beast::http::string_body>
+MetricsSession::CreateOKWithText(
+    const boost::beast::http::request<boost::beast::http::string_body>& req,
+    const std::string& content_type,
+    std::string body) {
+  boost::beast::http::response<boost::beast::http::string_body> res{
+      boost::beast::http::status::ok, 11};
+  res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+  res.set(boost::beast::http::field::content_type, content_type);
+  res.keep_alive(req.keep_alive());
+  res.body() = std::move(body);
+  res.prepare_payload();
+
+  return res;
+}
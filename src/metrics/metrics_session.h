@@ -4,6 +4,7 @@
 #include <cstdlib>
 #include <functional>
 #include <memory>
+#include <set>
 #include <string>
 
 #include <boost/asio/bind_executor.hpp>
@@ -51,6 +52,11 @@ class MetricsSession : public std::enable_shared_from_this<MetricsSession> {
   CreateOKWithJSON(
       const boost::beast::http::request<boost::beast::http::string_body>& req,
       boost::json::value json_message);
+  static boost::beast::http::response<boost::beast::http::string_body>
+  CreateOKWithText(
+      const boost::beast::http::request<boost::beast::http::string_body>& req,
+      const std::string& content_type,
+      std::string body);
 
   template <class Body, class Fields>
   void SendResponse(boost::beast::http::response<Body, Fields> msg) {
@@ -0,0 +1,245 @@
+#include "prometheus_exposition.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <map>
+#include <vector>
+
+// WebRTC
+#include <api/stats/attribute.h>
+#include <api/stats/rtc_stats.h>
+
+#include "latency_histogram.h"
+#include "momo_version.h"
+
+namespace {
+
+// 前回の出力サイズ。毎回少しずつ伸ばして再確保しないように使う
+std::atomic<size_t> g_last_output_size{0};
+
+// "outbound-rtp" + "bytesSent" -> "webrtc_outbound_rtp_bytes_sent"
+void AppendMetricName(std::string& out,
+                      const std::string& type,
+                      const char* name) {
+  out += "webrtc_";
+  for (char c : type) {
+    out += (c == '-' || c == '.') ? '_' : c;
+  }
+  out += '_';
+  for (const char* p = name; *p != '\0'; p++) {
+    char c = *p;
+    if (c >= 'A' && c <= 'Z') {
+      out += '_';
+      out += c - 'A' + 'a';
+    } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+      out += c;
+    } else {
+      out += '_';
+    }
+  }
+}
+
+bool IsNumeric(const webrtc::Attribute& attribute) {
+  return attribute.has_value() &&
+         (attribute.holds_alternative<bool>() ||
+          attribute.holds_alternative<int32_t>() ||
+          attribute.holds_alternative<uint32_t>() ||
+          attribute.holds_alternative<int64_t>() ||
+          attribute.holds_alternative<uint64_t>() ||
+          attribute.holds_alternative<double>());
+}
+
+void AppendAttributeValue(std::string& out,
+                          const webrtc::Attribute& attribute) {
+  if (attribute.holds_alternative<bool>()) {
+    out += attribute.get<bool>() ? '1' : '0';
+  } else if (attribute.holds_alternative<int32_t>()) {
+    PrometheusExposition::AppendValue(
+        out, static_cast<int64_t>(attribute.get<int32_t>()));
+  } else if (attribute.holds_alternative<uint32_t>()) {
+    PrometheusExposition::AppendValue(
+        out, static_cast<uint64_t>(attribute.get<uint32_t>()));
+  } else if (attribute.holds_alternative<int64_t>()) {
+    PrometheusExposition::AppendValue(out, attribute.get<int64_t>());
+  } else if (attribute.holds_alternative<uint64_t>()) {
+    PrometheusExposition::AppendValue(out, attribute.get<uint64_t>());
+  } else if (attribute.holds_alternative<double>()) {
+    PrometheusExposition::AppendValue(out, attribute.get<double>());
+  }
+}
+
+// {id="...",kind="video"} のようなラベルを追加する
+void AppendLabels(std::string& out,
+                  const webrtc::RTCStats& stats,
+                  const std::vector<webrtc::Attribute>& attributes) {
+  out += "{id=\"";
+  PrometheusExposition::AppendLabelValue(out, stats.id());
+  out += '"';
+  // 値を区別するのに必要な文字列の属性はラベルにする
+  for (const auto& attribute : attributes) {
+    if (!attribute.has_value() ||
+        !attribute.holds_alternative<std::string>()) {
+      continue;
+    }
+    std::string name = attribute.name();
+    if (name != "kind" && name != "rid" && name != "mid") {
+      continue;
+    }
+    out += ',';
+    out += name;
+    out += "=\"";
+    PrometheusExposition::AppendLabelValue(out,
+                                           attribute.get<std::string>());
+    out += '"';
+  }
+  out += '}';
+}
+
+void AppendStats(std::string& out,
+                 const std::string& type,
+                 const std::vector<const webrtc::RTCStats*>& stats_list) {
+  // Prometheus では同じメトリクスの行はまとめて出力する必要があるので、属性毎に全ての統計情報を出力する。
+  // 同じ種類の RTCStats は属性の並びが同じなので、インデックスで対応付ける。
+  std::vector<std::vector<webrtc::Attribute>> attributes_list;
+  attributes_list.reserve(stats_list.size());
+  size_t num_attributes = 0;
+  for (const webrtc::RTCStats* stats : stats_list) {
+    attributes_list.push_back(stats->Attributes());
+    num_attributes = std::max(num_attributes, attributes_list.back().size());
+  }
+
+  for (size_t i = 0; i < num_attributes; i++) {
+    bool header_written = false;
+    for (size_t j = 0; j < stats_list.size(); j++) {
+      const auto& attributes = attributes_list[j];
+      if (i >= attributes.size() || !IsNumeric(attributes[i])) {
+        continue;
+      }
+      if (!header_written) {
+        out += "# TYPE ";
+        AppendMetricName(out, type, attributes[i].name());
+        out += " untyped\n";
+        header_written = true;
+      }
+      AppendMetricName(out, type, attributes[i].name());
+      AppendLabels(out, *stats_list[j], attributes);
+      out += ' ';
+      AppendAttributeValue(out, attributes[i]);
+      out += '\n';
+    }
+  }
+}
+
+}  // namespace
+
+std::string PrometheusExposition::Format(const webrtc::RTCStatsReport* report,
+                                         const std::set<std::string>& types) {
+  std::string out;
+  out.reserve(g_last_output_size.load(std::memory_order_relaxed) + 1024);
+
+  out += "# TYPE momo_info gauge\nmomo_info{version=\"";
+  AppendLabelValue(out, MomoVersion::GetClientName());
+  out += "\",libwebrtc=\"";
+  AppendLabelValue(out, MomoVersion::GetLibwebrtcName());
+  out += "\",environment=\"";
+  AppendLabelValue(out, MomoVersion::GetEnvironmentName());
+  out += "\"} 1\n";
+
+  if (report != nullptr) {
+    // 種類毎にまとめる
+    std::map<std::string, std::vector<const webrtc::RTCStats*>> stats_by_type;
+    for (const webrtc::RTCStats& stats : *report) {
+      std::string type = stats.type();
+      if (!types.empty() && types.count(type) == 0) {
+        continue;
+      }
+      stats_by_type[type].push_back(&stats);
+    }
+    for (const auto& p : stats_by_type) {
+      AppendStats(out, p.first, p.second);
+    }
+  }
+
+  LatencyMetrics::Instance().AppendPrometheus(out);
+
+  g_last_output_size.store(out.size(), std::memory_order_relaxed);
+  return out;
+}
+
+std::set<std::string> PrometheusExposition::ParseTypes(
+    const std::string& target) {
+  std::set<std::string> types;
+  auto pos = target.find('?');
+  if (pos == std::string::npos) {
+    return types;
+  }
+  std::string query = target.substr(pos + 1);
+  size_t begin = 0;
+  while (begin <= query.size()) {
+    size_t end = query.find('&', begin);
+    if (end == std::string::npos) {
+      end = query.size();
+    }
+    std::string param = query.substr(begin, end - begin);
+    if (param.compare(0, 5, "type=") == 0) {
+      // カンマ区切りで複数指定できる
+      std::string value = param.substr(5);
+      size_t vbegin = 0;
+      while (vbegin <= value.size()) {
+        size_t vend = value.find(',', vbegin);
+        if (vend == std::string::npos) {
+          vend = value.size();
+        }
+        if (vend > vbegin) {
+          types.insert(value.substr(vbegin, vend - vbegin));
+        }
+        vbegin = vend + 1;
+      }
+    }
+    begin = end + 1;
+  }
+  return types;
+}
+
+void PrometheusExposition::AppendValue(std::string& out, int64_t value) {
+  char buf[24];
+  auto r = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, r.ptr);
+}
+
+void PrometheusExposition::AppendValue(std::string& out, uint64_t value) {
+  char buf[24];
+  auto r = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, r.ptr);
+}
+
+void PrometheusExposition::AppendValue(std::string& out, double value) {
+  if (std::isnan(value)) {
+    out += "NaN";
+    return;
+  }
+  if (std::isinf(value)) {
+    out += value > 0 ? "+Inf" : "-Inf";
+    return;
+  }
+  char buf[32];
+  auto r = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, r.ptr);
+}
+
+void PrometheusExposition::AppendLabelValue(std::string& out,
+                                            const std::string& value) {
+  for (char c : value) {
+    if (c == '\\') {
+      out += "\\\\";
+    } else if (c == '"') {
+      out += "\\\"";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else {
+      out += c;
+    }
+  }
+}
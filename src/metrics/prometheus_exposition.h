@@ -0,0 +1,34 @@
+#ifndef PROMETHEUS_EXPOSITION_H_
+#define PROMETHEUS_EXPOSITION_H_
+
+#include <set>
+#include <string>
+
+// WebRTC
+#include <api/stats/rtc_stats_report.h>
+
+// 統計情報を Prometheus のテキスト形式 (text/plain; version=0.0.4) で出力する。
+// RTCStatsReport を JSON にせず、RTCStats の属性を直接文字列に書き出す。
+class PrometheusExposition {
+ public:
+  static constexpr const char* kContentType =
+      "text/plain; version=0.0.4; charset=utf-8";
+
+  // types に含まれる種類 ("outbound-rtp" など) の統計情報だけを出力する。
+  // types が空の場合は全ての種類を出力する。
+  static std::string Format(const webrtc::RTCStatsReport* report,
+                            const std::set<std::string>& types);
+
+  // "/metrics/prometheus?type=outbound-rtp,inbound-rtp&type=transport" のような
+  // リクエストターゲットから、出力する統計情報の種類を取り出す
+  static std::set<std::string> ParseTypes(const std::string& target);
+
+  // Prometheus の値として数値を追加する
+  static void AppendValue(std::string& out, int64_t value);
+  static void AppendValue(std::string& out, uint64_t value);
+  static void AppendValue(std::string& out, double value);
+  // ラベルの値としてエスケープして追加する
+  static void AppendLabelValue(std::string& out, const std::string& value);
+};
+
+#endif
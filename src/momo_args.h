@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 // Boost
 #include <boost/json.hpp>
@@ -30,6 +31,10 @@ struct MomoArgs {
   // use_libcamera == true の場合だけ使える。
   // sora_video_codec_type == "H264" かつ sora_simulcast == false の場合だけしか機能しない。
   bool use_libcamera_native = false;
+  // Linux の V4L2 でキャプチャする場合だけ使える
+  int v4l2_buffer_count = 4;
+  bool v4l2_zero_copy = false;
+  int v4l2_mjpeg_decode_threads = 1;
   std::string video_device = "";
   std::string resolution = "VGA";
   int framerate = 30;
@@ -41,10 +46,17 @@ struct MomoArgs {
   bool fullscreen = false;
   std::string serial_device = "";
   unsigned int serial_rate = 9600;
+  // "line" or "binary"
+  std::string serial_framing = "line";
+  // 0 の場合はまとめて送らない
+  int serial_batch_bytes = 0;
+  int serial_batch_delay_ms = 10;
   bool insecure = false;
   bool screen_capture = false;
   int metrics_port = -1;
   bool metrics_allow_external_ip = false;
+  // GetStats の結果を使い回す時間 (ミリ秒)
+  int stats_cache_interval = 0;
   std::string client_cert;
   std::string client_key;
 
@@ -64,8 +76,14 @@ struct MomoArgs {
   std::string sora_role = "sendonly";
   bool sora_spotlight = false;
   int sora_spotlight_number = 0;
+  // 空文字の場合は Sora 側で決める
+  std::string sora_simulcast_rid = "";
+  std::string sora_spotlight_focus_rid = "";
+  std::string sora_spotlight_unfocus_rid = "";
   int sora_port = -1;
   bool sora_simulcast = false;
+  // サイマルキャストでソフトウェアエンコーダを使う場合に、各レイヤーを並列にエンコードする
+  bool sora_simulcast_parallel_encode = false;
   boost::optional<bool> sora_data_channel_signaling;
   int sora_data_channel_signaling_timeout = 180;
   boost::optional<bool> sora_ignore_disconnect_websocket;
@@ -96,6 +114,10 @@ struct MomoArgs {
   VideoCodecInfo::Type h265_decoder = VideoCodecInfo::Type::Default;
 
   std::string openh264;
+  // OpenH264 でエンコードに使う最大のスレッド数。0 の場合は自動で決める
+  int openh264_threads = 1;
+  // Intel VPL エンコーダで同時にエンコードするフレームの数
+  int vpl_async_depth = 1;
 
   std::string proxy_url;
   std::string proxy_username;
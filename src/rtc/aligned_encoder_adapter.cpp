@@ -1,6 +1,9 @@
 #include "aligned_encoder_adapter.h"
 
+#include <api/video/i420_buffer.h>
+#include <common_video/include/video_frame_buffer.h>
 #include <rtc_base/logging.h>
+#include <rtc_base/time_utils.h>
 
 static int Align(int size, int alignment) {
   return size - (size % alignment);
@@ -9,10 +12,13 @@ static int Align(int size, int alignment) {
 AlignedEncoderAdapter::AlignedEncoderAdapter(
     std::shared_ptr<webrtc::VideoEncoder> encoder,
     int horizontal_alignment,
-    int vertical_alignment)
+    int vertical_alignment,
+    LatencyMetrics* latency_metrics)
     : encoder_(encoder),
       horizontal_alignment_(horizontal_alignment),
-      vertical_alignment_(vertical_alignment) {}
+      vertical_alignment_(vertical_alignment),
+      latency_metrics_(latency_metrics),
+      buffer_pool_(false, 4) {}
 
 void AlignedEncoderAdapter::SetFecControllerOverride(
     webrtc::FecControllerOverride* fec_controller_override) {
@@ -40,22 +46,34 @@ int AlignedEncoderAdapter::InitEncode(
 int AlignedEncoderAdapter::Encode(
     const webrtc::VideoFrame& input_image,
     const std::vector<webrtc::VideoFrameType>* frame_types) {
+  const int64_t encode_start_us = rtc::TimeMicros();
+  if (latency_metrics_ != nullptr) {
+    latency_metrics_->CaptureToEncode().Add(encode_start_us -
+                                            input_image.timestamp_us());
+    int64_t source_us;
+    if (latency_metrics_->SourceFrameTimes().Get(input_image.timestamp_us(),
+                                                 &source_us)) {
+      latency_metrics_->SourceToEncode().Add(encode_start_us - source_us);
+    }
+  }
+
   auto frame = input_image;
-  auto frame_ratio = (double)frame.width() / frame.height();
-  auto target_ratio = (double)width_ / height_;
   int crop_width;
   int crop_height;
-  if (frame_ratio > target_ratio) {
+  // 浮動小数点で比率を計算すると 1071.99.. のように切り捨てられて
+  // 1 ピクセル足りなくなることがあるので、整数で計算する
+  if ((int64_t)frame.width() * height_ > (int64_t)frame.height() * width_) {
     // frame の横の方が広い場合は height に合わせる
     crop_height = frame.height();
-    crop_width = (int)(crop_height * target_ratio);
+    crop_width = (int)((int64_t)crop_height * width_ / height_);
   } else {
     // frame の縦の方が広い場合は width に合わせる
     crop_width = frame.width();
-    crop_height = (int)(crop_width / target_ratio);
+    crop_height = (int)((int64_t)crop_width * height_ / width_);
   }
-  auto crop_x = (frame.width() - crop_width) / 2;
-  auto crop_y = (frame.height() - crop_height) / 2;
+  // I420 の UV 面の位置がずれないように偶数にしておく
+  auto crop_x = ((frame.width() - crop_width) / 2) & ~1;
+  auto crop_y = ((frame.height() - crop_height) / 2) & ~1;
   // RTC_LOG(LS_INFO) << "type=" << frame.video_frame_buffer()->type()
   //                  << " crop_x=" << crop_x << " crop_y=" << crop_y
   //                  << " crop_width=" << crop_width
@@ -64,17 +82,67 @@ int AlignedEncoderAdapter::Encode(
   //                  << " frame_height=" << frame.height();
   if (crop_x != 0 || crop_y != 0 || frame.width() != width_ ||
       frame.height() != height_) {
-    auto buffer = frame.video_frame_buffer()->CropAndScale(
-        crop_x / 2, crop_y / 2, crop_width, crop_height, width_, height_);
-    frame.set_video_frame_buffer(buffer);
+    frame.set_video_frame_buffer(CropAndScale(frame.video_frame_buffer(),
+                                              crop_x, crop_y, crop_width,
+                                              crop_height));
+  }
+
+  if (latency_metrics_ != nullptr) {
+    // 同期的なエンコーダは Encode の中で OnEncodedImage を呼ぶので、先に記録しておく
+    const int64_t now_us = rtc::TimeMicros();
+    latency_metrics_->EncodeAlign().Add(now_us - encode_start_us);
+    encode_start_times_.Put(frame.timestamp(), now_us);
   }
 
   return encoder_->Encode(frame, frame_types);
 }
 
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> AlignedEncoderAdapter::CropAndScale(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+    int crop_x,
+    int crop_y,
+    int crop_width,
+    int crop_height) {
+  if (buffer->type() != webrtc::VideoFrameBuffer::Type::kI420) {
+    // ネイティブなバッファ等はそれぞれの CropAndScale に任せる
+    return buffer->CropAndScale(crop_x, crop_y, crop_width, crop_height,
+                                width_, height_);
+  }
+
+  const webrtc::I420BufferInterface* src = buffer->GetI420();
+  if (crop_width == width_ && crop_height == height_) {
+    // 縮小の必要が無い場合は、元のバッファの位置をずらして参照するだけにする。
+    // 1920x1080 を 1920x1072 にする場合等、ほとんどのフレームはこちらになる
+    int uv_x = crop_x / 2;
+    int uv_y = crop_y / 2;
+    return webrtc::WrapI420Buffer(
+        width_, height_, src->DataY() + src->StrideY() * crop_y + crop_x,
+        src->StrideY(), src->DataU() + src->StrideU() * uv_y + uv_x,
+        src->StrideU(), src->DataV() + src->StrideV() * uv_y + uv_x,
+        src->StrideV(),
+        // 参照している間は元のバッファを解放しないようにする
+        [buffer]() {});
+  }
+
+  rtc::scoped_refptr<webrtc::I420Buffer> scaled =
+      buffer_pool_.CreateI420Buffer(width_, height_);
+  if (scaled == nullptr) {
+    // プールが一杯の場合
+    scaled = webrtc::I420Buffer::Create(width_, height_);
+  }
+  scaled->CropAndScaleFrom(*src, crop_x, crop_y, crop_width, crop_height);
+  return scaled;
+}
+
 int AlignedEncoderAdapter::RegisterEncodeCompleteCallback(
     webrtc::EncodedImageCallback* callback) {
-  return encoder_->RegisterEncodeCompleteCallback(callback);
+  if (latency_metrics_ == nullptr) {
+    return encoder_->RegisterEncodeCompleteCallback(callback);
+  }
+  // エンコード結果の時刻を記録するために、間に挟まる
+  callback_ = callback;
+  return encoder_->RegisterEncodeCompleteCallback(callback != nullptr ? this
+                                                                      : nullptr);
 }
 void AlignedEncoderAdapter::SetRates(const RateControlParameters& parameters) {
   encoder_->SetRates(parameters);
@@ -94,3 +162,26 @@ webrtc::VideoEncoder::EncoderInfo AlignedEncoderAdapter::GetEncoderInfo()
     const {
   return encoder_->GetEncoderInfo();
 }
+
+webrtc::EncodedImageCallback::Result AlignedEncoderAdapter::OnEncodedImage(
+    const webrtc::EncodedImage& encoded_image,
+    const webrtc::CodecSpecificInfo* codec_specific_info) {
+  const int64_t encoded_us = rtc::TimeMicros();
+  int64_t encode_start_us;
+  if (encode_start_times_.Get(encoded_image.RtpTimestamp(), &encode_start_us)) {
+    latency_metrics_->Encode().Add(encoded_us - encode_start_us);
+  }
+  if (encoded_image.capture_time_ms_ > 0) {
+    latency_metrics_->CaptureToEncoded().Add(
+        encoded_us - encoded_image.capture_time_ms_ * 1000);
+  }
+
+  // 送信側の OnEncodedImage はパケット化して送信キューに入れるまでを同期的に行う
+  Result result = callback_->OnEncodedImage(encoded_image, codec_specific_info);
+  latency_metrics_->Packetize().Add(rtc::TimeMicros() - encoded_us);
+  return result;
+}
+
+void AlignedEncoderAdapter::OnDroppedFrame(DropReason reason) {
+  callback_->OnDroppedFrame(reason);
+}
@@ -8,16 +8,23 @@
 #include <api/video_codecs/video_encoder.h>
 #include <api/video_codecs/video_encoder_factory.h>
 #include <common_video/framerate_controller.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <modules/video_coding/include/video_codec_interface.h>
 #include <rtc_base/experiments/encoder_info_settings.h>
 #include <rtc_base/system/no_unique_address.h>
 #include <rtc_base/system/rtc_export.h>
 
-class AlignedEncoderAdapter : public webrtc::VideoEncoder {
+#include "metrics/latency_histogram.h"
+
+class AlignedEncoderAdapter : public webrtc::VideoEncoder,
+                              public webrtc::EncodedImageCallback {
  public:
+  // latency_metrics が指定されている場合、
+  // フレームのキャプチャ時刻から Encode が呼ばれるまでの時間や、エンコードの各段階の時間を記録する
   AlignedEncoderAdapter(std::shared_ptr<webrtc::VideoEncoder> encoder,
                         int horizontal_alignment,
-                        int vertical_alignment);
+                        int vertical_alignment,
+                        LatencyMetrics* latency_metrics = nullptr);
 
   void SetFecControllerOverride(
       webrtc::FecControllerOverride* fec_controller_override) override;
@@ -35,12 +42,31 @@ class AlignedEncoderAdapter : public webrtc::VideoEncoder {
 
   EncoderInfo GetEncoderInfo() const override;
 
+  // webrtc::EncodedImageCallback
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info) override;
+  void OnDroppedFrame(DropReason reason) override;
+
  private:
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> CropAndScale(
+      const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+      int crop_x,
+      int crop_y,
+      int crop_width,
+      int crop_height);
+
   std::shared_ptr<webrtc::VideoEncoder> encoder_;
   int horizontal_alignment_;
   int vertical_alignment_;
   int width_;
   int height_;
+  LatencyMetrics* latency_metrics_;
+  // crop に加えて縮小が必要な場合の出力先。Encode は同じスレッドから呼ばれる
+  webrtc::VideoFrameBufferPool buffer_pool_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  // エンコーダに渡した時刻。キーは RTP タイムスタンプ
+  FrameTimestampTable encode_start_times_;
 };
 
 #endif
\ No newline at end of file
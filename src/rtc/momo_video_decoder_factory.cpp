@@ -96,54 +96,61 @@ MomoVideoDecoderFactory::GetSupportedFormats() const {
     supported_codecs.push_back(webrtc::SdpVideoFormat(cricket::kH265CodecName));
   };
 
+  // 対応しているかどうかは毎回調べずに、起動時に調べた結果を使う
+  [[maybe_unused]] const VideoCodecInfo& info = VideoCodecInfo::Get();
+
 #if defined(USE_NVCODEC_ENCODER)
   if (config_.vp8_decoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoDecoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::VP8)) {
+      VideoCodecInfo::Contains(info.vp8_decoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_vp8();
   }
   if (config_.vp9_decoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoDecoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::VP9)) {
+      VideoCodecInfo::Contains(info.vp9_decoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_vp9();
   }
   if (config_.av1_decoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoDecoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::AV1)) {
+      VideoCodecInfo::Contains(info.av1_decoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_av1();
   }
   if (config_.h264_decoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoDecoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::H264)) {
+      VideoCodecInfo::Contains(info.h264_decoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_h264();
   }
   if (config_.h265_decoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoDecoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::H265)) {
+      VideoCodecInfo::Contains(info.h265_decoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_h265();
   }
 #endif
 
 #if defined(USE_VPL_ENCODER)
-  auto session = sora::VplSession::Create();
   if (config_.vp8_decoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoDecoder::IsSupported(session, webrtc::kVideoCodecVP8)) {
+      VideoCodecInfo::Contains(info.vp8_decoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_vp8();
   }
   if (config_.vp9_decoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoDecoder::IsSupported(session, webrtc::kVideoCodecVP9)) {
+      VideoCodecInfo::Contains(info.vp9_decoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_vp9();
   }
   if (config_.av1_decoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoDecoder::IsSupported(session, webrtc::kVideoCodecAV1)) {
+      VideoCodecInfo::Contains(info.av1_decoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_av1();
   }
   if (config_.h264_decoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoDecoder::IsSupported(session, webrtc::kVideoCodecH264)) {
+      VideoCodecInfo::Contains(info.h264_decoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_h264();
   }
   if (config_.h265_decoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoDecoder::IsSupported(session, webrtc::kVideoCodecH265)) {
+      VideoCodecInfo::Contains(info.h265_decoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_h265();
   }
 #endif
@@ -156,23 +163,28 @@ MomoVideoDecoderFactory::GetSupportedFormats() const {
 
 #if defined(USE_JETSON_ENCODER)
   if (config_.vp8_decoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoDecoder::IsSupported(webrtc::kVideoCodecVP8)) {
+      VideoCodecInfo::Contains(info.vp8_decoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_vp8();
   }
   if (config_.vp9_decoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoDecoder::IsSupported(webrtc::kVideoCodecVP9)) {
+      VideoCodecInfo::Contains(info.vp9_decoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_vp9();
   }
   if (config_.av1_decoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoDecoder::IsSupported(webrtc::kVideoCodecAV1)) {
+      VideoCodecInfo::Contains(info.av1_decoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_av1();
   }
   if (config_.h264_decoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoDecoder::IsSupported(webrtc::kVideoCodecH264)) {
+      VideoCodecInfo::Contains(info.h264_decoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_h264();
   }
   if (config_.h265_decoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoDecoder::IsSupported(webrtc::kVideoCodecH265)) {
+      VideoCodecInfo::Contains(info.h265_decoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_h265();
   }
 #endif
@@ -42,6 +42,7 @@
 #include "sora/open_h264_video_encoder.h"
 
 #include "rtc/aligned_encoder_adapter.h"
+#include "rtc/parallel_simulcast_encoder.h"
 
 MomoVideoEncoderFactory::MomoVideoEncoderFactory(
     const MomoVideoEncoderFactoryConfig& config)
@@ -53,6 +54,7 @@ MomoVideoEncoderFactory::MomoVideoEncoderFactory(
     auto config2 = config;
     config2.simulcast = false;
     internal_encoder_factory_.reset(new MomoVideoEncoderFactory(config2));
+    internal_encoder_factory_->is_internal_ = true;
   }
 }
 
@@ -93,54 +95,61 @@ MomoVideoEncoderFactory::GetSupportedFormats() const {
     supported_codecs.push_back(webrtc::SdpVideoFormat(cricket::kH265CodecName));
   };
 
+  // 対応しているかどうかは毎回調べずに、起動時に調べた結果を使う
+  [[maybe_unused]] const VideoCodecInfo& info = VideoCodecInfo::Get();
+
 #if defined(USE_NVCODEC_ENCODER)
   if (config_.vp8_encoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoEncoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::VP8)) {
+      VideoCodecInfo::Contains(info.vp8_encoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_vp8();
   }
   if (config_.vp9_encoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoEncoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::VP9)) {
+      VideoCodecInfo::Contains(info.vp9_encoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_vp9();
   }
   if (config_.av1_encoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoEncoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::AV1)) {
+      VideoCodecInfo::Contains(info.av1_encoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_av1();
   }
   if (config_.h264_encoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoEncoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::H264)) {
+      VideoCodecInfo::Contains(info.h264_encoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_h264();
   }
   if (config_.h265_encoder == VideoCodecInfo::Type::NVIDIA &&
-      sora::NvCodecVideoEncoder::IsSupported(config_.cuda_context,
-                                             sora::CudaVideoCodec::H265)) {
+      VideoCodecInfo::Contains(info.h265_encoders,
+                               VideoCodecInfo::Type::NVIDIA)) {
     add_h265();
   }
 #endif
 
 #if defined(USE_VPL_ENCODER)
-  auto session = sora::VplSession::Create();
   if (config_.vp8_encoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoEncoder::IsSupported(session, webrtc::kVideoCodecVP8)) {
+      VideoCodecInfo::Contains(info.vp8_encoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_vp8();
   }
   if (config_.vp9_encoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoEncoder::IsSupported(session, webrtc::kVideoCodecVP9)) {
+      VideoCodecInfo::Contains(info.vp9_encoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_vp9();
   }
   if (config_.av1_encoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoEncoder::IsSupported(session, webrtc::kVideoCodecAV1)) {
+      VideoCodecInfo::Contains(info.av1_encoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_av1();
   }
   if (config_.h264_encoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoEncoder::IsSupported(session, webrtc::kVideoCodecH264)) {
+      VideoCodecInfo::Contains(info.h264_encoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_h264();
   }
   if (config_.h265_encoder == VideoCodecInfo::Type::Intel &&
-      sora::VplVideoEncoder::IsSupported(session, webrtc::kVideoCodecH265)) {
+      VideoCodecInfo::Contains(info.h265_encoders,
+                               VideoCodecInfo::Type::Intel)) {
     add_h265();
   }
 #endif
@@ -153,23 +162,28 @@ MomoVideoEncoderFactory::GetSupportedFormats() const {
 
 #if defined(USE_JETSON_ENCODER)
   if (config_.vp8_encoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoEncoder::IsSupported(webrtc::kVideoCodecVP8)) {
+      VideoCodecInfo::Contains(info.vp8_encoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_vp8();
   }
   if (config_.vp9_encoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoEncoder::IsSupported(webrtc::kVideoCodecVP9)) {
+      VideoCodecInfo::Contains(info.vp9_encoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_vp9();
   }
   if (config_.av1_encoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoEncoder::IsSupported(webrtc::kVideoCodecAV1)) {
+      VideoCodecInfo::Contains(info.av1_encoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_av1();
   }
   if (config_.h264_encoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoEncoder::IsSupported(webrtc::kVideoCodecH264)) {
+      VideoCodecInfo::Contains(info.h264_encoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_h264();
   }
   if (config_.h265_encoder == VideoCodecInfo::Type::Jetson &&
-      sora::JetsonVideoEncoder::IsSupported(webrtc::kVideoCodecH265)) {
+      VideoCodecInfo::Contains(info.h265_encoders,
+                               VideoCodecInfo::Type::Jetson)) {
     add_h265();
   }
 #endif
@@ -310,19 +324,24 @@ std::unique_ptr<webrtc::VideoEncoder> MomoVideoEncoderFactory::CreateInternal(
 #if defined(USE_VPL_ENCODER)
   auto session = sora::VplSession::Create();
   if (is_vp8 && config_.vp8_encoder == VideoCodecInfo::Type::Intel) {
-    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecVP8);
+    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecVP8,
+                                         config_.vpl_async_depth);
   }
   if (is_vp9 && config_.vp9_encoder == VideoCodecInfo::Type::Intel) {
-    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecVP9);
+    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecVP9,
+                                         config_.vpl_async_depth);
   }
   if (is_av1 && config_.av1_encoder == VideoCodecInfo::Type::Intel) {
-    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecAV1);
+    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecAV1,
+                                         config_.vpl_async_depth);
   }
   if (is_h264 && config_.h264_encoder == VideoCodecInfo::Type::Intel) {
-    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecH264);
+    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecH264,
+                                         config_.vpl_async_depth);
   }
   if (is_h265 && config_.h265_encoder == VideoCodecInfo::Type::Intel) {
-    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecH265);
+    return sora::VplVideoEncoder::Create(session, webrtc::kVideoCodecH265,
+                                         config_.vpl_async_depth);
   }
 #endif
 
@@ -380,7 +399,10 @@ std::unique_ptr<webrtc::VideoEncoder> MomoVideoEncoderFactory::CreateInternal(
     return webrtc::CreateLibaomAv1Encoder(env);
   }
   if (is_h264 && config_.h264_encoder == VideoCodecInfo::Type::Software) {
-    return sora::CreateOpenH264VideoEncoder(format, config_.openh264);
+    // スレッド数はここでは分けずに、サイマルキャストのレイヤー間での分配は
+    // InitEncode (並列エンコードの場合は ParallelSimulcastEncoder::InitEncode) に任せる
+    return sora::CreateOpenH264VideoEncoder(format, config_.openh264,
+                                            config_.openh264_threads);
   }
   // if (is_h265 && config_.h265_encoder == VideoCodecInfo::Type::Software) {
   //   return nullptr;
@@ -391,17 +413,47 @@ std::unique_ptr<webrtc::VideoEncoder> MomoVideoEncoderFactory::CreateInternal(
   return nullptr;
 }
 
+bool MomoVideoEncoderFactory::IsSoftwareEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName)) {
+    return config_.vp8_encoder == VideoCodecInfo::Type::Software;
+  }
+  if (absl::EqualsIgnoreCase(format.name, cricket::kVp9CodecName)) {
+    return config_.vp9_encoder == VideoCodecInfo::Type::Software;
+  }
+  if (absl::EqualsIgnoreCase(format.name, cricket::kAv1CodecName)) {
+    return config_.av1_encoder == VideoCodecInfo::Type::Software;
+  }
+  if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName)) {
+    return config_.h264_encoder == VideoCodecInfo::Type::Software;
+  }
+  return false;
+}
+
 std::unique_ptr<webrtc::VideoEncoder> MomoVideoEncoderFactory::WithSimulcast(
     const webrtc::SdpVideoFormat& format,
     std::function<std::unique_ptr<webrtc::VideoEncoder>(
         const webrtc::SdpVideoFormat&)> create) {
   std::shared_ptr<webrtc::VideoEncoder> encoder;
-  if (internal_encoder_factory_) {
+  if (internal_encoder_factory_ && config_.simulcast_parallel_encode &&
+      IsSoftwareEncoder(format)) {
+    int max_threads =
+        absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName)
+            ? config_.openh264_threads
+            : 0;
+    encoder = std::make_shared<ParallelSimulcastEncoder>(
+        webrtc::CreateEnvironment(), internal_encoder_factory_.get(), format,
+        max_threads);
+  } else if (internal_encoder_factory_) {
     encoder = std::make_shared<webrtc::SimulcastEncoderAdapter>(
         webrtc::CreateEnvironment(), internal_encoder_factory_.get(), nullptr,
         format);
   } else {
     encoder.reset(create(format).release());
   }
-  return std::make_unique<AlignedEncoderAdapter>(encoder, 16, 16);
+  // サイマルキャストの各レイヤーで記録すると重複するので、一番外側だけで記録する
+  LatencyMetrics* latency_metrics =
+      is_internal_ ? nullptr : &LatencyMetrics::Instance();
+  return std::make_unique<AlignedEncoderAdapter>(encoder, 16, 16,
+                                                 latency_metrics);
 }
@@ -27,17 +27,23 @@ struct MomoVideoEncoderFactoryConfig {
   VideoCodecInfo::Type h264_encoder;
   VideoCodecInfo::Type h265_encoder;
   bool simulcast;
+  // ソフトウェアエンコーダでのサイマルキャストで、各レイヤーを並列にエンコードする
+  bool simulcast_parallel_encode = false;
   bool hardware_encoder_only;
 #if defined(USE_NVCODEC_ENCODER)
   std::shared_ptr<sora::CudaContext> cuda_context;
 #endif
   std::string openh264;
+  int openh264_threads = 1;
+  int vpl_async_depth = 1;
 };
 
 class MomoVideoEncoderFactory : public webrtc::VideoEncoderFactory {
   MomoVideoEncoderFactoryConfig config_;
   std::unique_ptr<webrtc::VideoEncoderFactory> video_encoder_factory_;
   std::unique_ptr<MomoVideoEncoderFactory> internal_encoder_factory_;
+  // SimulcastEncoderAdapter から各レイヤーのエンコーダを作るためのファクトリかどうか
+  bool is_internal_ = false;
 
  public:
   MomoVideoEncoderFactory(const MomoVideoEncoderFactoryConfig& config);
@@ -53,6 +59,8 @@ class MomoVideoEncoderFactory : public webrtc::VideoEncoderFactory {
   std::unique_ptr<webrtc::VideoEncoder> CreateInternal(
       const webrtc::Environment& env,
       const webrtc::SdpVideoFormat& format);
+  // ソフトウェアエンコーダを使うフォーマットかどうか
+  bool IsSoftwareEncoder(const webrtc::SdpVideoFormat& format) const;
   std::unique_ptr<webrtc::VideoEncoder> WithSimulcast(
       const webrtc::SdpVideoFormat& format,
       std::function<std::unique_ptr<webrtc::VideoEncoder>(
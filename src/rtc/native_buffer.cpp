@@ -2,7 +2,9 @@
 
 // WebRTC
 #include <api/video/i420_buffer.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <rtc_base/checks.h>
+#include <rtc_base/logging.h>
 #include <third_party/libyuv/include/libyuv.h>
 
 static const int kBufferAlignment = 64;
@@ -13,6 +15,31 @@ int ArgbDataSize(int height, int width) {
   return width * height * 4;
 }
 
+// ToI420 の出力と、縮小前の中間バッファに使うプール。
+// 解像度が変わるとプールの中身が捨てられるので、出力用と中間用で分けておく。
+// NativeBuffer はフレーム毎に作られて色々なスレッドから ToI420 されるので、ロックして使う。
+webrtc::Mutex g_pool_mutex;
+webrtc::VideoFrameBufferPool& OutputPool() {
+  static webrtc::VideoFrameBufferPool pool(false, 8);
+  return pool;
+}
+webrtc::VideoFrameBufferPool& IntermediatePool() {
+  static webrtc::VideoFrameBufferPool pool(false, 4);
+  return pool;
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> CreateOutputBuffer(int width,
+                                                          int height) {
+  webrtc::MutexLock lock(&g_pool_mutex);
+  return OutputPool().CreateI420Buffer(width, height);
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> CreateIntermediateBuffer(int width,
+                                                                int height) {
+  webrtc::MutexLock lock(&g_pool_mutex);
+  return IntermediatePool().CreateI420Buffer(width, height);
+}
+
 }  // namespace
 
 rtc::scoped_refptr<NativeBuffer>
@@ -25,6 +52,10 @@ webrtc::VideoFrameBuffer::Type NativeBuffer::type() const {
 }
 
 void NativeBuffer::InitializeData() {
+  {
+    webrtc::MutexLock lock(&i420_mutex_);
+    i420_buffer_ = nullptr;
+  }
   memset(data_.get(), 0, ArgbDataSize(raw_height_, raw_width_));
 }
 
@@ -37,17 +68,43 @@ int NativeBuffer::height() const {
 }
 
 rtc::scoped_refptr<webrtc::I420BufferInterface> NativeBuffer::ToI420() {
+  // 最初に呼んだスレッドが変換し、同時に呼んだ他のスレッドはその結果を待って使う
+  webrtc::MutexLock lock(&i420_mutex_);
+  if (!i420_buffer_) {
+    i420_buffer_ = Convert();
+  }
+  return i420_buffer_;
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface> NativeBuffer::Convert() {
+  bool direct = raw_width_ == scaled_width_ && raw_height_ == scaled_height_;
   rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
-      webrtc::I420Buffer::Create(raw_width_, raw_height_);
+      direct ? CreateOutputBuffer(raw_width_, raw_height_)
+             : CreateIntermediateBuffer(raw_width_, raw_height_);
+  if (i420_buffer == nullptr) {
+    // プールが一杯の場合
+    i420_buffer = webrtc::I420Buffer::Create(raw_width_, raw_height_);
+  }
   const int conversionResult = libyuv::ConvertToI420(
       data_.get(), length_, i420_buffer.get()->MutableDataY(),
       i420_buffer.get()->StrideY(), i420_buffer.get()->MutableDataU(),
       i420_buffer.get()->StrideU(), i420_buffer.get()->MutableDataV(),
       i420_buffer.get()->StrideV(), 0, 0, raw_width_, raw_height_, raw_width_,
       raw_height_, libyuv::kRotate0, ConvertVideoType(video_type_));
+  if (conversionResult != 0) {
+    RTC_LOG(LS_ERROR) << "Failed to convert NativeBuffer to I420: type="
+                      << static_cast<int>(video_type_);
+    return nullptr;
+  }
+  if (direct) {
+    return i420_buffer;
+  }
   rtc::scoped_refptr<webrtc::I420Buffer> scaled_buffer =
-      webrtc::I420Buffer::Create(scaled_width_, scaled_height_);
-  scaled_buffer->ScaleFrom(*i420_buffer->ToI420());
+      CreateOutputBuffer(scaled_width_, scaled_height_);
+  if (scaled_buffer == nullptr) {
+    scaled_buffer = webrtc::I420Buffer::Create(scaled_width_, scaled_height_);
+  }
+  scaled_buffer->ScaleFrom(*i420_buffer);
   return scaled_buffer;
 }
 
@@ -60,12 +117,16 @@ int NativeBuffer::RawHeight() const {
 }
 
 void NativeBuffer::SetScaledSize(int scaled_width, int scaled_height) {
+  webrtc::MutexLock lock(&i420_mutex_);
   scaled_width_ = scaled_width;
   scaled_height_ = scaled_height;
+  i420_buffer_ = nullptr;
 }
 
 void NativeBuffer::SetLength(size_t length) {
+  webrtc::MutexLock lock(&i420_mutex_);
   length_ = length;
+  i420_buffer_ = nullptr;
 }
 
 size_t NativeBuffer::Length() const {
@@ -6,6 +6,8 @@
 #include <common_video/include/video_frame_buffer.h>
 #include <common_video/libyuv/include/webrtc_libyuv.h>
 #include <rtc_base/memory/aligned_malloc.h>
+#include <rtc_base/synchronization/mutex.h>
+#include <rtc_base/thread_annotations.h>
 
 class NativeBuffer : public webrtc::VideoFrameBuffer {
  public:
@@ -18,6 +20,8 @@ class NativeBuffer : public webrtc::VideoFrameBuffer {
   Type type() const override;
   int width() const override;
   int height() const override;
+  // 変換結果はバッファ内に保持するので、同じフレームを何度 ToI420 しても変換は 1 回で済む。
+  // データやサイズを書き換えた場合は SetLength や SetScaledSize で破棄される。
   rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override;
 
   int RawWidth() const;
@@ -34,6 +38,8 @@ class NativeBuffer : public webrtc::VideoFrameBuffer {
   ~NativeBuffer() override;
 
  private:
+  rtc::scoped_refptr<webrtc::I420BufferInterface> Convert();
+
   const int raw_width_;
   const int raw_height_;
   int scaled_width_;
@@ -41,6 +47,10 @@ class NativeBuffer : public webrtc::VideoFrameBuffer {
   size_t length_;
   const webrtc::VideoType video_type_;
   const std::unique_ptr<uint8_t, webrtc::AlignedFreeDeleter> data_;
+
+  webrtc::Mutex i420_mutex_;
+  rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer_
+      RTC_GUARDED_BY(i420_mutex_);
 };
 
 #endif  // NATIVE_BUFFER_H_
@@ -0,0 +1,280 @@
+#include "parallel_simulcast_encoder.h"
+
+#include <algorithm>
+#include <utility>
+
+// WebRTC
+#include <absl/types/optional.h>
+#include <api/video/video_codec_constants.h>
+#include <media/engine/simulcast_encoder_adapter.h>
+#include <modules/video_coding/include/video_error_codes.h>
+
+namespace {
+
+// 各レイヤーのエンコーダ。Encode はスレッドプールに積んで即座に返す。
+// エンコード結果は SimulcastEncodePool::Wait で呼び出し元のスレッドから渡す。
+class ParallelLayerEncoder : public webrtc::VideoEncoder,
+                             public webrtc::EncodedImageCallback {
+ public:
+  ParallelLayerEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder,
+                       std::shared_ptr<SimulcastEncodePool> pool)
+      : encoder_(std::move(encoder)), pool_(std::move(pool)) {}
+
+  void SetFecControllerOverride(
+      webrtc::FecControllerOverride* fec_controller_override) override {
+    encoder_->SetFecControllerOverride(fec_controller_override);
+  }
+  int Release() override { return encoder_->Release(); }
+  int InitEncode(const webrtc::VideoCodec* codec_settings,
+                 const webrtc::VideoEncoder::Settings& settings) override {
+    return encoder_->InitEncode(codec_settings, settings);
+  }
+  int Encode(const webrtc::VideoFrame& input_image,
+             const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    // frame_types は呼び出し元のスタックにあるのでコピーしておく
+    absl::optional<std::vector<webrtc::VideoFrameType>> types;
+    if (frame_types != nullptr) {
+      types = *frame_types;
+    }
+    auto job = std::make_shared<SimulcastEncodePool::Job>();
+    job->encode = [this, job = job.get(), frame = input_image,
+                   types = std::move(types)]() {
+      current_job_ = job;
+      int r = encoder_->Encode(frame, types ? &*types : nullptr);
+      current_job_ = nullptr;
+      return r;
+    };
+    pool_->Post(std::move(job));
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    callback_ = callback;
+    return encoder_->RegisterEncodeCompleteCallback(this);
+  }
+  void SetRates(const RateControlParameters& parameters) override {
+    encoder_->SetRates(parameters);
+  }
+  void OnPacketLossRateUpdate(float packet_loss_rate) override {
+    encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+  }
+  void OnRttUpdate(int64_t rtt_ms) override { encoder_->OnRttUpdate(rtt_ms); }
+  void OnLossNotification(const LossNotification& loss_notification) override {
+    encoder_->OnLossNotification(loss_notification);
+  }
+  EncoderInfo GetEncoderInfo() const override {
+    EncoderInfo info = encoder_->GetEncoderInfo();
+    // OpenH264 や libvpx の VP8 はサイマルキャストに対応しているので、そのままだと
+    // SimulcastEncoderAdapter が全レイヤーを 1 つのエンコーダに任せてしまい、並列にならない。
+    // 対応していないことにして、レイヤー毎にエンコーダを作らせる。
+    info.supports_simulcast = false;
+    return info;
+  }
+
+  // webrtc::EncodedImageCallback
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info) override {
+    if (current_job_ == nullptr) {
+      // Encode の外から呼ばれた場合はそのまま渡す
+      return callback_->OnEncodedImage(encoded_image, codec_specific_info);
+    }
+    // エンコードされたデータは次の Encode までは書き換えられないので、
+    // EncodedImage はバッファの参照ごとコピーしておけば良い
+    absl::optional<webrtc::CodecSpecificInfo> info;
+    if (codec_specific_info != nullptr) {
+      info = *codec_specific_info;
+    }
+    current_job_->deliveries.push_back(
+        [this, image = encoded_image, info = std::move(info)]() {
+          callback_->OnEncodedImage(image, info ? &*info : nullptr);
+        });
+    return Result(Result::OK);
+  }
+  void OnDroppedFrame(DropReason reason) override {
+    if (current_job_ == nullptr) {
+      callback_->OnDroppedFrame(reason);
+      return;
+    }
+    current_job_->deliveries.push_back(
+        [this, reason]() { callback_->OnDroppedFrame(reason); });
+  }
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  std::shared_ptr<SimulcastEncodePool> pool_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  // ワーカースレッドでエンコード中のジョブ
+  SimulcastEncodePool::Job* current_job_ = nullptr;
+};
+
+}  // namespace
+
+// SimulcastEncodePool
+
+SimulcastEncodePool::SimulcastEncodePool(int num_threads) {
+  for (int i = 0; i < num_threads; i++) {
+    threads_.push_back(rtc::PlatformThread::SpawnJoinable(
+        [this]() { Run(); }, "SimulcastEncode",
+        rtc::ThreadAttributes().SetPriority(rtc::ThreadPriority::kHigh)));
+  }
+}
+
+SimulcastEncodePool::~SimulcastEncodePool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread.Finalize();
+  }
+}
+
+void SimulcastEncodePool::Post(std::shared_ptr<Job> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(job);
+    tasks_.push_back(std::move(job));
+    pending_++;
+  }
+  cond_.notify_one();
+}
+
+int SimulcastEncodePool::Wait() {
+  std::vector<std::shared_ptr<Job>> jobs;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this]() { return pending_ == 0; });
+    jobs.swap(jobs_);
+  }
+  int result = WEBRTC_VIDEO_CODEC_OK;
+  for (const auto& job : jobs) {
+    for (const auto& delivery : job->deliveries) {
+      delivery();
+    }
+    if (result == WEBRTC_VIDEO_CODEC_OK) {
+      result = job->result;
+    }
+  }
+  return result;
+}
+
+void SimulcastEncodePool::Run() {
+  while (true) {
+    std::shared_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return quit_ || !tasks_.empty(); });
+      if (quit_) {
+        return;
+      }
+      job = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    job->result = job->encode();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_--;
+    }
+    done_cond_.notify_all();
+  }
+}
+
+// ParallelLayerEncoderFactory
+
+ParallelLayerEncoderFactory::ParallelLayerEncoderFactory(
+    webrtc::VideoEncoderFactory* factory,
+    std::shared_ptr<SimulcastEncodePool> pool)
+    : factory_(factory), pool_(std::move(pool)) {}
+
+std::vector<webrtc::SdpVideoFormat>
+ParallelLayerEncoderFactory::GetSupportedFormats() const {
+  return factory_->GetSupportedFormats();
+}
+
+std::unique_ptr<webrtc::VideoEncoder> ParallelLayerEncoderFactory::Create(
+    const webrtc::Environment& env,
+    const webrtc::SdpVideoFormat& format) {
+  auto encoder = factory_->Create(env, format);
+  if (encoder == nullptr) {
+    return nullptr;
+  }
+  return std::make_unique<ParallelLayerEncoder>(std::move(encoder), pool_);
+}
+
+// ParallelSimulcastEncoder
+
+ParallelSimulcastEncoder::ParallelSimulcastEncoder(
+    const webrtc::Environment& env,
+    webrtc::VideoEncoderFactory* factory,
+    const webrtc::SdpVideoFormat& format,
+    int max_threads)
+    : pool_(std::make_shared<SimulcastEncodePool>(
+          webrtc::kMaxSimulcastStreams)),
+      factory_(new ParallelLayerEncoderFactory(factory, pool_)),
+      encoder_(new webrtc::SimulcastEncoderAdapter(env, factory_.get(),
+                                                   nullptr,
+                                                   format)),
+      max_threads_(max_threads) {}
+
+ParallelSimulcastEncoder::~ParallelSimulcastEncoder() {
+  encoder_.reset();
+}
+
+void ParallelSimulcastEncoder::SetFecControllerOverride(
+    webrtc::FecControllerOverride* fec_controller_override) {
+  encoder_->SetFecControllerOverride(fec_controller_override);
+}
+int ParallelSimulcastEncoder::Release() {
+  return encoder_->Release();
+}
+int ParallelSimulcastEncoder::InitEncode(
+    const webrtc::VideoCodec* codec_settings,
+    const webrtc::VideoEncoder::Settings& settings) {
+  // 各レイヤーのエンコーダは 1 ストリームしか持たず、エンコーダの中では
+  // レイヤー間でスレッドを分けられないので、ここで有効なレイヤー数で割っておく
+  int layers = 0;
+  for (int i = 0; i < codec_settings->numberOfSimulcastStreams; i++) {
+    if (codec_settings->simulcastStream[i].active) {
+      layers++;
+    }
+  }
+  int total_threads = max_threads_ == 0
+                          ? settings.number_of_cores
+                          : std::min(max_threads_, settings.number_of_cores);
+  webrtc::VideoEncoder::Settings layer_settings = settings;
+  layer_settings.number_of_cores =
+      std::max(1, total_threads / std::max(1, layers));
+  return encoder_->InitEncode(codec_settings, layer_settings);
+}
+int ParallelSimulcastEncoder::Encode(
+    const webrtc::VideoFrame& input_image,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  int r = encoder_->Encode(input_image, frame_types);
+  // 途中で失敗した場合も、積んだエンコードは全て終わらせておく
+  int wait_result = pool_->Wait();
+  return r != WEBRTC_VIDEO_CODEC_OK ? r : wait_result;
+}
+int ParallelSimulcastEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  return encoder_->RegisterEncodeCompleteCallback(callback);
+}
+void ParallelSimulcastEncoder::SetRates(
+    const RateControlParameters& parameters) {
+  encoder_->SetRates(parameters);
+}
+void ParallelSimulcastEncoder::OnPacketLossRateUpdate(float packet_loss_rate) {
+  encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+}
+void ParallelSimulcastEncoder::OnRttUpdate(int64_t rtt_ms) {
+  encoder_->OnRttUpdate(rtt_ms);
+}
+void ParallelSimulcastEncoder::OnLossNotification(
+    const LossNotification& loss_notification) {
+  encoder_->OnLossNotification(loss_notification);
+}
+webrtc::VideoEncoder::EncoderInfo ParallelSimulcastEncoder::GetEncoderInfo()
+    const {
+  return encoder_->GetEncoderInfo();
+}
@@ -0,0 +1,109 @@
+#ifndef PARALLEL_SIMULCAST_ENCODER_H_
+#define PARALLEL_SIMULCAST_ENCODER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// WebRTC
+#include <api/environment/environment.h>
+#include <api/video_codecs/sdp_video_format.h>
+#include <api/video_codecs/video_encoder.h>
+#include <api/video_codecs/video_encoder_factory.h>
+#include <modules/video_coding/include/video_codec_interface.h>
+#include <modules/video_coding/include/video_error_codes.h>
+#include <rtc_base/platform_thread.h>
+
+// サイマルキャストの各レイヤーのエンコードを並列に実行するためのスレッドプール。
+// 1 フレーム分のエンコードを Post で積み、Wait で全て終わるのを待つ。
+class SimulcastEncodePool {
+ public:
+  // 1 つのレイヤーのエンコード。
+  // エンコード結果のコールバックは呼び出し元のスレッドで Wait の中から呼ぶので、ここに溜めておく
+  struct Job {
+    std::function<int()> encode;
+    int result = WEBRTC_VIDEO_CODEC_OK;
+    std::vector<std::function<void()>> deliveries;
+  };
+
+  explicit SimulcastEncodePool(int num_threads);
+  ~SimulcastEncodePool();
+
+  void Post(std::shared_ptr<Job> job);
+  // Post したエンコードが全て終わるのを待ってから、Post した順にエンコード結果を渡す。
+  // 失敗したエンコードがあった場合は最初のエラーを返す。
+  int Wait();
+
+ private:
+  void Run();
+
+  std::vector<rtc::PlatformThread> threads_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable done_cond_;
+  std::deque<std::shared_ptr<Job>> tasks_;
+  // Post された順に並んでいる
+  std::vector<std::shared_ptr<Job>> jobs_;
+  int pending_ = 0;
+  bool quit_ = false;
+};
+
+// SimulcastEncoderAdapter が作る各レイヤーのエンコーダを、
+// Encode をスレッドプールに積んで即座に返すエンコーダでラップするファクトリ。
+class ParallelLayerEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  ParallelLayerEncoderFactory(webrtc::VideoEncoderFactory* factory,
+                              std::shared_ptr<SimulcastEncodePool> pool);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+  std::unique_ptr<webrtc::VideoEncoder> Create(
+      const webrtc::Environment& env,
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  webrtc::VideoEncoderFactory* factory_;
+  std::shared_ptr<SimulcastEncodePool> pool_;
+};
+
+// ソフトウェアエンコーダでのサイマルキャストで、各レイヤーのエンコードを並列に行う。
+// SimulcastEncoderAdapter の各レイヤーの Encode はスレッドプールに積まれるだけなので、
+// SimulcastEncoderAdapter の Encode が返った後に全てのレイヤーの完了を待つ。
+// これで 1 フレームのエンコード時間は、全レイヤーの合計ではなく一番遅いレイヤーの時間に近くなる。
+class ParallelSimulcastEncoder : public webrtc::VideoEncoder {
+ public:
+  // max_threads は全レイヤーで使うスレッド数の上限で、0 の場合はコア数を上限にする。
+  // InitEncode で有効なレイヤー数で割って、各レイヤーのエンコーダに number_of_cores として渡す。
+  ParallelSimulcastEncoder(const webrtc::Environment& env,
+                           webrtc::VideoEncoderFactory* factory,
+                           const webrtc::SdpVideoFormat& format,
+                           int max_threads);
+  ~ParallelSimulcastEncoder() override;
+
+  void SetFecControllerOverride(
+      webrtc::FecControllerOverride* fec_controller_override) override;
+  int Release() override;
+  int InitEncode(const webrtc::VideoCodec* codec_settings,
+                 const webrtc::VideoEncoder::Settings& settings) override;
+  int Encode(const webrtc::VideoFrame& input_image,
+             const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  int RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  void OnPacketLossRateUpdate(float packet_loss_rate) override;
+  void OnRttUpdate(int64_t rtt_ms) override;
+  void OnLossNotification(const LossNotification& loss_notification) override;
+
+  EncoderInfo GetEncoderInfo() const override;
+
+ private:
+  std::shared_ptr<SimulcastEncodePool> pool_;
+  // encoder_ から参照されるので、encoder_ より先に宣言しておく
+  std::unique_ptr<ParallelLayerEncoderFactory> factory_;
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  int max_threads_;
+};
+
+#endif
@@ -5,32 +5,6 @@
 #include <api/scoped_refptr.h>
 #include <rtc_base/ref_counted_object.h>
 
-// stats のコールバックを受け取るためのクラス
-class RTCStatsCallback : public webrtc::RTCStatsCollectorCallback {
- public:
-  typedef std::function<void(
-      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)>
-      ResultCallback;
-
-  static RTCStatsCallback* Create(ResultCallback result_callback) {
-    return new rtc::RefCountedObject<RTCStatsCallback>(
-        std::move(result_callback));
-  }
-
-  void OnStatsDelivered(
-      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) override {
-    std::move(result_callback_)(report);
-  }
-
- protected:
-  RTCStatsCallback(ResultCallback result_callback)
-      : result_callback_(std::move(result_callback)) {}
-  ~RTCStatsCallback() override = default;
-
- private:
-  ResultCallback result_callback_;
-};
-
 // CreateSessionDescriptionObserver のコールバックを関数オブジェクトで扱えるようにするためのクラス
 class CreateSessionDescriptionThunk
     : public webrtc::CreateSessionDescriptionObserver {
@@ -314,7 +288,7 @@ bool RTCConnection::IsMediaEnabled(
 void RTCConnection::GetStats(
     std::function<void(const rtc::scoped_refptr<const webrtc::RTCStatsReport>&)>
         callback) {
-  connection_->GetStats(RTCStatsCallback::Create(std::move(callback)));
+  stats_cache_->GetStats(connection_.get(), std::move(callback));
 }
 
 std::string RtpTransceiverDirectionToString(
@@ -5,15 +5,18 @@
 #include <api/peer_connection_interface.h>
 
 #include "peer_connection_observer.h"
+#include "rtc_stats_cache.h"
 
 class RTCConnection {
  public:
   RTCConnection(RTCMessageSender* sender,
                 std::unique_ptr<PeerConnectionObserver> observer,
-                rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection)
+                rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection,
+                int stats_cache_interval_ms = 0)
       : sender_(sender),
         observer_(std::move(observer)),
-        connection_(connection) {}
+        connection_(connection),
+        stats_cache_(RTCStatsCache::Create(stats_cache_interval_ms)) {}
   ~RTCConnection();
 
   typedef std::function<void(webrtc::SessionDescriptionInterface*)>
@@ -41,6 +44,7 @@ class RTCConnection {
   bool IsAudioEnabled();
   bool IsVideoEnabled();
 
+  // stats_cache_interval_ms の間は、前回取得した統計情報を返す
   void GetStats(
       std::function<void(
           const rtc::scoped_refptr<const webrtc::RTCStatsReport>&)> callback);
@@ -67,6 +71,7 @@ class RTCConnection {
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection_;
   std::vector<webrtc::RtpEncodingParameters> encodings_;
   std::string mid_;
+  std::shared_ptr<RTCStatsCache> stats_cache_;
 };
 
 #endif
@@ -90,7 +90,7 @@ RTCManager::RTCManager(
       webrtc::CreateBuiltinAudioDecoderFactory();
 
   {
-    auto info = VideoCodecInfo::Get();
+    const auto& info = VideoCodecInfo::Get();
     // 名前を短くする
     auto& cf = config_;
     auto resolve = &VideoCodecInfo::Resolve;
@@ -101,11 +101,14 @@ RTCManager::RTCManager(
     ec.h264_encoder = resolve(cf.h264_encoder, info.h264_encoders);
     ec.h265_encoder = resolve(cf.h265_encoder, info.h265_encoders);
     ec.simulcast = cf.simulcast;
+    ec.simulcast_parallel_encode = cf.simulcast_parallel_encode;
     ec.hardware_encoder_only = cf.hardware_encoder_only;
 #if defined(USE_NVCODEC_ENCODER)
     ec.cuda_context = cf.cuda_context;
 #endif
     ec.openh264 = cf.openh264;
+    ec.openh264_threads = cf.openh264_threads;
+    ec.vpl_async_depth = cf.vpl_async_depth;
     dependencies.video_encoder_factory =
         std::unique_ptr<webrtc::VideoEncoderFactory>(
             absl::make_unique<MomoVideoEncoderFactory>(ec));
@@ -188,6 +191,8 @@ RTCManager::RTCManager(
         video_track_->set_content_hint(
             webrtc::VideoTrackInterface::ContentHint::kText);
       }
+      video_track_->AddOrUpdateSink(&frame_timing_sink_,
+                                    rtc::VideoSinkWants());
     } else {
       RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Cannot create video_track";
     }
@@ -196,6 +201,10 @@ RTCManager::RTCManager(
 
 RTCManager::~RTCManager() {
   audio_track_ = nullptr;
+  video_sender_ = nullptr;
+  if (video_track_) {
+    video_track_->RemoveSink(&frame_timing_sink_);
+  }
   video_track_ = nullptr;
   factory_ = nullptr;
   network_thread_->Stop();
@@ -285,7 +294,8 @@ std::shared_ptr<RTCConnection> RTCManager::CreateConnection(
   }
 
   return std::make_shared<RTCConnection>(sender, std::move(observer),
-                                         connection.value());
+                                         connection.value(),
+                                         config_.stats_cache_interval_ms);
 }
 
 void RTCManager::InitTracks(RTCConnection* conn) {
@@ -10,6 +10,7 @@
 #include <pc/peer_connection_factory.h>
 #include <pc/video_track_source.h>
 
+#include "metrics/frame_timing_sink.h"
 #include "rtc_connection.h"
 #include "rtc_data_manager_dispatcher.h"
 #include "rtc_message_sender.h"
@@ -56,6 +57,7 @@ struct RTCManagerConfig {
 
   bool fixed_resolution = false;
   bool simulcast = false;
+  bool simulcast_parallel_encode = false;
   bool hardware_encoder_only = false;
 
   bool disable_echo_cancellation = false;
@@ -75,6 +77,8 @@ struct RTCManagerConfig {
   VideoCodecInfo::Type h265_decoder = VideoCodecInfo::Type::Default;
 
   std::string openh264;
+  int openh264_threads = 1;
+  int vpl_async_depth = 1;
 
   std::string priority = "FRAMERATE";
 
@@ -94,6 +98,9 @@ struct RTCManagerConfig {
   std::string proxy_url;
   std::string proxy_username;
   std::string proxy_password;
+
+  // GetStats の結果を使い回す時間 (ミリ秒)。0 の場合は毎回取得する
+  int stats_cache_interval_ms = 0;
 };
 
 class RTCManager {
@@ -116,6 +123,8 @@ class RTCManager {
   rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
   rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
   rtc::scoped_refptr<webrtc::RtpSenderInterface> video_sender_;
+  // 送信する映像のレイテンシを記録するためのシンク
+  FrameTimingSink frame_timing_sink_;
   std::unique_ptr<rtc::Thread> network_thread_;
   std::unique_ptr<rtc::Thread> worker_thread_;
   std::unique_ptr<rtc::Thread> signaling_thread_;
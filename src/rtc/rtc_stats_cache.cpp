@@ -0,0 +1,82 @@
+#include "rtc_stats_cache.h"
+
+// WebRTC
+#include <rtc_base/ref_counted_object.h>
+#include <rtc_base/thread.h>
+#include <rtc_base/time_utils.h>
+
+// stats のコールバックを受け取るためのクラス
+class RTCStatsCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  typedef std::function<void(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)>
+      ResultCallback;
+
+  static RTCStatsCallback* Create(ResultCallback result_callback) {
+    return new rtc::RefCountedObject<RTCStatsCallback>(
+        std::move(result_callback));
+  }
+
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) override {
+    std::move(result_callback_)(report);
+  }
+
+ protected:
+  RTCStatsCallback(ResultCallback result_callback)
+      : result_callback_(std::move(result_callback)) {}
+  ~RTCStatsCallback() override = default;
+
+ private:
+  ResultCallback result_callback_;
+};
+
+std::shared_ptr<RTCStatsCache> RTCStatsCache::Create(int interval_ms) {
+  return std::shared_ptr<RTCStatsCache>(new RTCStatsCache(interval_ms));
+}
+
+void RTCStatsCache::GetStats(webrtc::PeerConnectionInterface* connection,
+                             ResultCallback callback) {
+  rtc::scoped_refptr<const webrtc::RTCStatsReport> cached;
+  {
+    webrtc::MutexLock lock(&mutex_);
+    if (interval_ms_ > 0 && report_ &&
+        rtc::TimeMillis() - report_time_ms_ < interval_ms_) {
+      cached = report_;
+    } else {
+      callbacks_.push_back(std::move(callback));
+      // 取得中なら、その結果で一緒に返す
+      if (pending_) {
+        return;
+      }
+      pending_ = true;
+    }
+  }
+  // キャッシュを使う場合も、取得した場合と同じく signaling スレッドで callback を呼ぶ
+  if (cached) {
+    connection->signaling_thread()->PostTask(
+        [callback = std::move(callback), cached]() { callback(cached); });
+    return;
+  }
+
+  connection->GetStats(RTCStatsCallback::Create(
+      [self = shared_from_this()](
+          const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+        self->OnStatsDelivered(report);
+      }));
+}
+
+void RTCStatsCache::OnStatsDelivered(
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+  std::vector<ResultCallback> callbacks;
+  {
+    webrtc::MutexLock lock(&mutex_);
+    report_ = report;
+    report_time_ms_ = rtc::TimeMillis();
+    pending_ = false;
+    callbacks.swap(callbacks_);
+  }
+  for (auto& callback : callbacks) {
+    callback(report);
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef RTC_STATS_CACHE_H_
+#define RTC_STATS_CACHE_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+// WebRTC
+#include <api/peer_connection_interface.h>
+#include <api/scoped_refptr.h>
+#include <api/stats/rtc_stats_report.h>
+#include <rtc_base/synchronization/mutex.h>
+
+// PeerConnection::GetStats の結果を一定時間使い回すためのクラス。
+// GetStats は signaling/network/worker スレッドを巡回するので、
+// MetricsServer や Sora の ping など複数の利用者がいても、interval_ms に 1 回しか呼ばないようにする。
+// 取得中に来たリクエストは、その取得結果でまとめて返す。
+class RTCStatsCache : public std::enable_shared_from_this<RTCStatsCache> {
+ public:
+  typedef std::function<void(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>&)>
+      ResultCallback;
+
+  // interval_ms が 0 以下の場合はキャッシュしない
+  static std::shared_ptr<RTCStatsCache> Create(int interval_ms);
+
+  // キャッシュが有効ならその結果で、そうでなければ取得後に callback を呼ぶ。
+  // どちらの場合も callback は signaling スレッドで呼ばれる。
+  void GetStats(webrtc::PeerConnectionInterface* connection,
+                ResultCallback callback);
+
+ private:
+  RTCStatsCache(int interval_ms) : interval_ms_(interval_ms) {}
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
+
+  const int interval_ms_;
+  webrtc::Mutex mutex_;
+  rtc::scoped_refptr<const webrtc::RTCStatsReport> report_
+      RTC_GUARDED_BY(mutex_);
+  int64_t report_time_ms_ RTC_GUARDED_BY(mutex_) = 0;
+  bool pending_ RTC_GUARDED_BY(mutex_) = false;
+  std::vector<ResultCallback> callbacks_ RTC_GUARDED_BY(mutex_);
+};
+
+#endif
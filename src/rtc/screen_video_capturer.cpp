@@ -8,8 +8,10 @@
 #include "screen_video_capturer.h"
 
 #include <stdint.h>
+#include <string.h>
 
 #include <iostream>
+#include <limits>
 #include <memory>
 
 // WebRTC
@@ -20,7 +22,6 @@
 #include <rtc_base/checks.h>
 #include <rtc_base/logging.h>
 #include <rtc_base/time_utils.h>
-#include <system_wrappers/include/sleep.h>
 #include <third_party/libyuv/include/libyuv.h>
 
 #include "native_buffer.h"
@@ -60,6 +61,9 @@ ScreenVideoCapturer::ScreenVideoCapturer(
       max_height_(max_height),
       requested_frame_duration_((int)(1000.0f / target_fps)),
       max_cpu_consumption_percentage_(50),
+      buffer_pool_(false, 4),
+      last_convert_duration_ms_(0),
+      unchanged_frames_(0),
       quit_(false) {
   auto options = CreateDesktopCaptureOptions();
   std::unique_ptr<webrtc::DesktopCapturer> screen_capturer(
@@ -71,6 +75,13 @@ ScreenVideoCapturer::ScreenVideoCapturer(
   }
 
   capturer_->Start(this);
+  next_capture_time_ = std::chrono::steady_clock::now();
+  if (convert_thread_.empty()) {
+    convert_thread_ = rtc::PlatformThread::SpawnJoinable(
+        std::bind(ScreenVideoCapturer::ConvertThread, this),
+        "ScreenConvertThread",
+        rtc::ThreadAttributes().SetPriority(rtc::ThreadPriority::kHigh));
+  }
   if (capture_thread_.empty()) {
     capture_thread_ = rtc::PlatformThread::SpawnJoinable(
         std::bind(ScreenVideoCapturer::CaptureThread, this),
@@ -80,11 +91,20 @@ ScreenVideoCapturer::ScreenVideoCapturer(
 }
 
 ScreenVideoCapturer::~ScreenVideoCapturer() {
-  if (!capture_thread_.empty()) {
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
     quit_ = true;
+  }
+  pending_cond_.notify_all();
+  if (!capture_thread_.empty()) {
     capture_thread_.Finalize();
   }
+  if (!convert_thread_.empty()) {
+    convert_thread_.Finalize();
+  }
+  pending_frame_.reset();
   output_frame_.reset();
+  output_buffer_ = nullptr;
   previous_frame_size_.set(0, 0);
   capturer_.reset();
 }
@@ -110,19 +130,93 @@ void ScreenVideoCapturer::CaptureThread(void* obj) {
 }
 
 bool ScreenVideoCapturer::CaptureProcess() {
-  if (quit_) {
-    return false;
+  {
+    // 前のフレームの変換が終わって破棄されるのを待つ。
+    // フレームの破棄時にはキャプチャ側の共有バッファにカーソルの下の画素を書き戻すことがあり、
+    // キャプチャはその共有バッファから変化していない部分を読むので、並行して動かすことはできない
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    pending_cond_.wait(lock, [this]() {
+      return quit_ || (!pending_frame_ && !converting_);
+    });
+    if (quit_) {
+      return false;
+    }
   }
 
   int64_t started_time = rtc::TimeMillis();
   capturer_->CaptureFrame();
   int last_capture_duration = (int)(rtc::TimeMillis() - started_time);
-  int capture_period =
-      std::max((last_capture_duration * 100) / max_cpu_consumption_percentage_,
-               requested_frame_duration_);
-  int delta_time = capture_period - last_capture_duration;
-  if (delta_time > 0) {
-    webrtc::SleepMs(delta_time);
+
+  // 前回の予定時刻から間隔を足して次の予定時刻にすることで、処理時間の揺らぎが溜まらないようにする。
+  // 予定時刻を過ぎてしまっている場合は、まとめてキャプチャしないように今から数え直す。
+  auto now = std::chrono::steady_clock::now();
+  next_capture_time_ += std::chrono::milliseconds(
+      NextCapturePeriodMs(last_capture_duration));
+  if (next_capture_time_ < now) {
+    next_capture_time_ = now;
+  }
+
+  std::unique_lock<std::mutex> lock(pending_mutex_);
+  pending_cond_.wait_until(lock, next_capture_time_,
+                           [this]() { return quit_.load(); });
+  return !quit_;
+}
+
+int ScreenVideoCapturer::NextCapturePeriodMs(int capture_duration_ms) {
+  int period = requested_frame_duration_;
+  // CPU 使用率の上限を超えないようにする
+  period = std::max(
+      period, (capture_duration_ms * 100) / max_cpu_consumption_percentage_);
+  // 変換スレッドより速くキャプチャしても待たされるだけなので、変換の時間に合わせる
+  period = std::max(period, last_convert_duration_ms_.load());
+  // エンコーダ側から要求されたフレームレートに合わせる。
+  // エンコードが追いつかない場合は CPU 使用率の検出などにより max_framerate_fps が下がる
+  int max_fps = max_framerate_fps();
+  if (max_fps > 0 && max_fps < std::numeric_limits<int>::max()) {
+    period = std::max(period, 1000 / max_fps);
+  }
+  // 画面が変化しない状態が続いている場合は、徐々にキャプチャの間隔を広げる。
+  // 変化を検出したらすぐに元の間隔に戻る
+  int unchanged = unchanged_frames_.load();
+  if (unchanged >= kIdleFrameThreshold) {
+    int idle_period = period * (1 + unchanged / kIdleFrameThreshold);
+    period = std::max(period, std::min(idle_period, kMaxIdleCaptureIntervalMs));
+  }
+  return period;
+}
+
+void ScreenVideoCapturer::ConvertThread(void* obj) {
+  auto self = static_cast<ScreenVideoCapturer*>(obj);
+  while (self->ConvertProcess()) {
+  }
+}
+
+bool ScreenVideoCapturer::ConvertProcess() {
+  std::unique_ptr<webrtc::DesktopFrame> frame;
+  {
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    pending_cond_.wait(lock, [this]() { return quit_ || pending_frame_; });
+    if (quit_) {
+      return false;
+    }
+    frame = std::move(pending_frame_);
+    converting_ = true;
+  }
+
+  // 変換はキャプチャスレッドが次のキャプチャ時刻まで待っている間に行う
+  int64_t started_time = rtc::TimeMillis();
+  // frame は ConvertFrame の中で破棄される
+  bool changed = ConvertFrame(std::move(frame));
+  last_convert_duration_ms_ = (int)(rtc::TimeMillis() - started_time);
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    converting_ = false;
+  }
+  pending_cond_.notify_all();
+  if (changed) {
+    unchanged_frames_ = 0;
+  } else {
+    unchanged_frames_++;
   }
   return true;
 }
@@ -138,6 +232,20 @@ void ScreenVideoCapturer::OnCaptureResult(
     return;
   }
 
+  // 変換は別のスレッドで行う
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_frame_ = std::move(frame);
+  }
+  pending_cond_.notify_all();
+}
+
+bool ScreenVideoCapturer::ConvertFrame(
+    std::unique_ptr<webrtc::DesktopFrame> frame) {
+  int64_t now_ms = rtc::TimeMillis();
+
+  // 前回と同じ出力バッファに書き込めない場合は、全体を変換し直す
+  bool full_update = output_buffer_ == nullptr;
   if (!previous_frame_size_.equals(frame->size())) {
     output_frame_.reset();
     capture_width_ = frame->size().width();
@@ -154,6 +262,7 @@ void ScreenVideoCapturer::OnCaptureResult(
     }
     //std::cout << "capture_width_:" << capture_width_ << " capture_height_:" << capture_height_ << std::endl << std::flush;
     previous_frame_size_ = frame->size();
+    full_update = true;
   }
   webrtc::DesktopSize output_size(capture_width_ & ~1, capture_height_ & ~1);
   if (output_size.is_empty()) {
@@ -166,13 +275,59 @@ void ScreenVideoCapturer::OnCaptureResult(
   //  << " output_size.width():" << output_size.width()
   //  << " output_size.height():" << output_size.height();
 
+  const int64_t total_pixels =
+      static_cast<int64_t>(frame->size().width()) * frame->size().height();
+
+  // 画面が変化していない場合は、キープアライブの間隔が来るまでフレームを送らない
+  webrtc::DesktopRegion updated_region;
+  if (!full_update) {
+    updated_region = frame->updated_region();
+    updated_region.IntersectWith(webrtc::DesktopRect::MakeSize(frame->size()));
+    if (updated_region.is_empty()) {
+      if (now_ms - last_sent_ms_ < kKeepaliveIntervalMs) {
+        UpdateDamageStats(now_ms, false, 0, total_pixels);
+        return false;
+      }
+      // 前回のバッファはそのまま送って良い
+      UpdateDamageStats(now_ms, true, 0, total_pixels);
+      last_sent_ms_ = now_ms;
+      webrtc::VideoFrame captureFrame =
+          webrtc::VideoFrame::Builder()
+              .set_video_frame_buffer(output_buffer_)
+              .set_timestamp_rtp(0)
+              .set_timestamp_ms(now_ms)
+              .set_rotation(webrtc::kVideoRotation_0)
+              .build();
+      ScalableVideoTrackSource::OnFrame(captureFrame);
+      return false;
+    }
+  }
+
   //rtc::scoped_refptr<NativeBuffer> native_buffer(NativeBuffer::Create(
   //    webrtc::VideoType::kARGB, output_size.width(), output_size.height()));
   //native_buffer->InitializeData();
-  rtc::scoped_refptr<webrtc::I420Buffer> dst_buffer(
-      webrtc::I420Buffer::Create(output_size.width(), output_size.height()));
-  dst_buffer->InitializeData();
+  // 送ったバッファはエンコーダ等が参照しているので、プールから新しいバッファを取り出して
+  // 前回の内容をコピーした上で、更新された部分だけを書き換える
+  rtc::scoped_refptr<webrtc::I420Buffer> dst_buffer =
+      buffer_pool_.CreateI420Buffer(output_size.width(), output_size.height());
+  if (!dst_buffer) {
+    dst_buffer =
+        webrtc::I420Buffer::Create(output_size.width(), output_size.height());
+  }
+  if (full_update) {
+    dst_buffer->InitializeData();
+  } else {
+    libyuv::I420Copy(
+        output_buffer_->DataY(), output_buffer_->StrideY(),
+        output_buffer_->DataU(), output_buffer_->StrideU(),
+        output_buffer_->DataV(), output_buffer_->StrideV(),
+        dst_buffer->MutableDataY(), dst_buffer->StrideY(),
+        dst_buffer->MutableDataU(), dst_buffer->StrideU(),
+        dst_buffer->MutableDataV(), dst_buffer->StrideV(), output_size.width(),
+        output_size.height());
+  }
 
+  int64_t damaged_pixels = total_pixels;
   if (frame->size().width() <= 2 || frame->size().height() <= 1) {
   } else {
     const int32_t frame_width = frame->size().width();
@@ -184,67 +339,168 @@ void ScreenVideoCapturer::OnCaptureResult(
           webrtc::DesktopRect::MakeWH(frame_width & ~1, frame_height & ~1));
     }
 
-    const uint8_t* output_data = nullptr;
-    int output_stride = 0;
-    if (!frame->size().equals(output_size)) {
-      if (!output_frame_) {
-        output_frame_.reset(new webrtc::BasicDesktopFrame(output_size));
+    if (full_update) {
+      updated_region.SetRect(webrtc::DesktopRect::MakeSize(frame->size()));
+    } else {
+      updated_region.IntersectWith(
+          webrtc::DesktopRect::MakeSize(frame->size()));
+      damaged_pixels = 0;
+      for (webrtc::DesktopRegion::Iterator it(updated_region); !it.IsAtEnd();
+           it.Advance()) {
+        damaged_pixels +=
+            static_cast<int64_t>(it.rect().width()) * it.rect().height();
       }
-      webrtc::DesktopRect output_rect;
+    }
+
+    ConvertUpdatedRegion(*frame, updated_region, output_size,
+                         dst_buffer.get());
+  }
+
+  UpdateDamageStats(now_ms, true, damaged_pixels, total_pixels);
+  output_buffer_ = dst_buffer;
+  last_sent_ms_ = now_ms;
+
+  webrtc::VideoFrame captureFrame = webrtc::VideoFrame::Builder()
+                                        .set_video_frame_buffer(dst_buffer)
+                                        .set_timestamp_rtp(0)
+                                        .set_timestamp_ms(now_ms)
+                                        .set_rotation(webrtc::kVideoRotation_0)
+                                        .build();
+  ScalableVideoTrackSource::OnFrame(captureFrame);
+  return true;
+}
+
+void ScreenVideoCapturer::ConvertUpdatedRegion(
+    const webrtc::DesktopFrame& frame,
+    const webrtc::DesktopRegion& updated_region,
+    const webrtc::DesktopSize& output_size,
+    webrtc::I420Buffer* dst) {
+  const uint8_t* output_data = nullptr;
+  int output_stride = 0;
+  // output_data 上で更新された領域。I420 に変換するために偶数に揃える
+  webrtc::DesktopRegion output_region;
+  if (!frame.size().equals(output_size)) {
+    if (!output_frame_) {
+      output_frame_.reset(new webrtc::BasicDesktopFrame(output_size));
+      memset(output_frame_->data(), 0,
+             output_frame_->stride() * output_size.height());
       if ((float)output_size.width() / (float)output_size.height() <
-          (float)frame->size().width() / (float)frame->size().height()) {
-        int32_t output_height = frame->size().height() * output_size.width() /
-                                frame->size().width();
+          (float)frame.size().width() / (float)frame.size().height()) {
+        int32_t output_height =
+            frame.size().height() * output_size.width() / frame.size().width();
         if (output_height > output_size.height())
           output_height = output_size.height();
         const int32_t margin_y = (output_size.height() - output_height) / 2;
         //RTC_LOG(LS_ERROR) << __FUNCTION__ << "output_size.width():" << output_size.width() << " output_height:" << output_height;
-        output_rect = webrtc::DesktopRect::MakeLTRB(
+        output_rect_ = webrtc::DesktopRect::MakeLTRB(
             0, margin_y, output_size.width(), output_height + margin_y);
       } else {
-        int32_t output_width = frame->size().width() * output_size.height() /
-                               frame->size().height();
+        int32_t output_width =
+            frame.size().width() * output_size.height() / frame.size().height();
         if (output_width > output_size.width())
           output_width = output_size.width();
         const int32_t margin_x = (output_size.width() - output_width) / 2;
         //RTC_LOG(LS_ERROR) << __FUNCTION__ << "output_width:" << output_width << " output_size.height():" << output_size.height();
-        output_rect = webrtc::DesktopRect::MakeLTRB(
+        output_rect_ = webrtc::DesktopRect::MakeLTRB(
             margin_x, 0, output_width + margin_x, output_size.height());
       }
-      uint8_t* output_rect_data =
-          output_frame_->GetFrameDataAtPos(output_rect.top_left());
-      libyuv::ARGBScale(frame->data(), frame->stride(), frame->size().width(),
-                        frame->size().height(), output_rect_data,
-                        output_frame_->stride(), output_rect.width(),
-                        output_rect.height(), libyuv::kFilterBox);
-      output_data = output_frame_->data();
-      output_stride = output_frame_->stride();
-    } else {
-      output_data = frame->data();
-      output_stride = frame->stride();
-      //RTC_LOG(LS_ERROR) << __FUNCTION__ << "output_stride:" << output_stride;
+      // 余白も含めて全体を変換する
+      output_region.SetRect(webrtc::DesktopRect::MakeSize(output_size));
+    }
+    uint8_t* output_rect_data =
+        output_frame_->GetFrameDataAtPos(output_rect_.top_left());
+    for (webrtc::DesktopRegion::Iterator it(updated_region); !it.IsAtEnd();
+         it.Advance()) {
+      // 縮小先の座標に変換する。
+      // フィルタは周囲の画素も参照するので、1 画素ずつ広げておく
+      const webrtc::DesktopRect& r = it.rect();
+      int left = r.left() * output_rect_.width() / frame.size().width() - 1;
+      int top = r.top() * output_rect_.height() / frame.size().height() - 1;
+      int right = (r.right() * output_rect_.width() + frame.size().width() - 1) /
+                      frame.size().width() +
+                  1;
+      int bottom =
+          (r.bottom() * output_rect_.height() + frame.size().height() - 1) /
+              frame.size().height() +
+          1;
+      webrtc::DesktopRect clip = webrtc::DesktopRect::MakeLTRB(
+          left, top, right, bottom);
+      clip.IntersectWith(webrtc::DesktopRect::MakeSize(output_rect_.size()));
+      if (clip.is_empty()) {
+        continue;
+      }
+      libyuv::ARGBScaleClip(frame.data(), frame.stride(), frame.size().width(),
+                            frame.size().height(), output_rect_data,
+                            output_frame_->stride(), output_rect_.width(),
+                            output_rect_.height(), clip.left(), clip.top(),
+                            clip.width(), clip.height(), libyuv::kFilterBox);
+      clip.Translate(output_rect_.left(), output_rect_.top());
+      output_region.AddRect(clip);
     }
+    output_data = output_frame_->data();
+    output_stride = output_frame_->stride();
+  } else {
+    output_data = frame.data();
+    output_stride = frame.stride();
+    //RTC_LOG(LS_ERROR) << __FUNCTION__ << "output_stride:" << output_stride;
+    output_region = updated_region;
+  }
 
+  for (webrtc::DesktopRegion::Iterator it(output_region); !it.IsAtEnd();
+       it.Advance()) {
+    // I420 の色差は 2x2 画素単位なので、矩形を偶数の座標に広げる
+    webrtc::DesktopRect r = webrtc::DesktopRect::MakeLTRB(
+        it.rect().left() & ~1, it.rect().top() & ~1,
+        (it.rect().right() + 1) & ~1, (it.rect().bottom() + 1) & ~1);
+    r.IntersectWith(webrtc::DesktopRect::MakeSize(output_size));
+    if (r.is_empty()) {
+      continue;
+    }
     if (libyuv::ARGBToI420(
-            output_data, output_stride, dst_buffer.get()->MutableDataY(),
-            dst_buffer.get()->StrideY(), dst_buffer.get()->MutableDataU(),
-            dst_buffer.get()->StrideU(), dst_buffer.get()->MutableDataV(),
-            dst_buffer.get()->StrideV(), output_size.width(),
-            output_size.height()) < 0) {
+            output_data + r.top() * output_stride +
+                r.left() * webrtc::DesktopFrame::kBytesPerPixel,
+            output_stride,
+            dst->MutableDataY() + r.top() * dst->StrideY() + r.left(),
+            dst->StrideY(),
+            dst->MutableDataU() + r.top() / 2 * dst->StrideU() + r.left() / 2,
+            dst->StrideU(),
+            dst->MutableDataV() + r.top() / 2 * dst->StrideV() + r.left() / 2,
+            dst->StrideV(), r.width(), r.height()) < 0) {
       RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
       return;
     }
-    //for (uint32_t y = 0; y < output_size.height(); y++) {
-    //  memcpy(native_buffer->MutableData() + y * native_buffer->width() * 4,
-    //         output_data + y * output_stride, native_buffer->width() * 4);
-    //}
   }
+}
 
-  webrtc::VideoFrame captureFrame = webrtc::VideoFrame::Builder()
-                                        .set_video_frame_buffer(dst_buffer)
-                                        .set_timestamp_rtp(0)
-                                        .set_timestamp_ms(rtc::TimeMillis())
-                                        .set_rotation(webrtc::kVideoRotation_0)
-                                        .build();
-  ScalableVideoTrackSource::OnFrame(captureFrame);
+void ScreenVideoCapturer::UpdateDamageStats(int64_t now_ms,
+                                            bool sent,
+                                            int64_t damaged_pixels,
+                                            int64_t total_pixels) {
+  if (stats_start_ms_ == 0) {
+    stats_start_ms_ = now_ms;
+  }
+  stats_captured_frames_++;
+  if (sent) {
+    stats_sent_frames_++;
+  }
+  stats_damaged_pixels_ += damaged_pixels;
+  stats_total_pixels_ += total_pixels;
+
+  if (now_ms - stats_start_ms_ < kDamageStatsIntervalMs) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << "ScreenVideoCapturer damage stats: captured="
+                   << stats_captured_frames_ << " sent=" << stats_sent_frames_
+                   << " skipped="
+                   << (stats_captured_frames_ - stats_sent_frames_)
+                   << " damaged_ratio="
+                   << (stats_total_pixels_ == 0
+                           ? 0.0
+                           : (double)stats_damaged_pixels_ /
+                                 stats_total_pixels_);
+  stats_start_ms_ = now_ms;
+  stats_captured_frames_ = 0;
+  stats_sent_frames_ = 0;
+  stats_damaged_pixels_ = 0;
+  stats_total_pixels_ = 0;
 }
@@ -1,11 +1,17 @@
 #ifndef SCREEN_VIDEO_CAPTURER_H_
 #define SCREEN_VIDEO_CAPTURER_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 // WebRTC
 #include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <modules/desktop_capture/desktop_capturer.h>
 #include <modules/video_capture/video_capture.h>
 #include <rtc_base/platform_thread.h>
@@ -26,9 +32,33 @@ class ScreenVideoCapturer : public sora::ScalableVideoTrackSource,
  private:
   static void CaptureThread(void* obj);
   bool CaptureProcess();
+  // 次のキャプチャまでの間隔を、エンコーダからの要求や画面の変化の頻度から決める
+  int NextCapturePeriodMs(int capture_duration_ms);
+  static void ConvertThread(void* obj);
+  bool ConvertProcess();
   static webrtc::DesktopCaptureOptions CreateDesktopCaptureOptions();
   void OnCaptureResult(webrtc::DesktopCapturer::Result result,
                        std::unique_ptr<webrtc::DesktopFrame> frame) override;
+  // キャプチャしたフレームを I420 に変換して送る。画面が変化していた場合は true を返す
+  bool ConvertFrame(std::unique_ptr<webrtc::DesktopFrame> frame);
+  // frame の updated_region の部分だけを縮小して dst に書き込む
+  void ConvertUpdatedRegion(const webrtc::DesktopFrame& frame,
+                            const webrtc::DesktopRegion& updated_region,
+                            const webrtc::DesktopSize& output_size,
+                            webrtc::I420Buffer* dst);
+  void UpdateDamageStats(int64_t now_ms,
+                         bool sent,
+                         int64_t damaged_pixels,
+                         int64_t total_pixels);
+
+  // 画面に変化が無い場合でも、この間隔でフレームを送る
+  static constexpr int kKeepaliveIntervalMs = 1000;
+  // 更新領域の統計情報をログに出す間隔
+  static constexpr int kDamageStatsIntervalMs = 10000;
+  // この回数続けて画面が変化しなかった場合は、キャプチャの間隔を広げていく
+  static constexpr int kIdleFrameThreshold = 10;
+  // 画面が変化していない場合のキャプチャの最大の間隔
+  static constexpr int kMaxIdleCaptureIntervalMs = 200;
 
   size_t max_width_;
   size_t max_height_;
@@ -38,6 +68,33 @@ class ScreenVideoCapturer : public sora::ScalableVideoTrackSource,
   int max_cpu_consumption_percentage_;
   webrtc::DesktopSize previous_frame_size_;
   std::unique_ptr<webrtc::DesktopFrame> output_frame_;
+  // output_frame_ 上で、キャプチャしたフレームを縮小して書き込む領域
+  webrtc::DesktopRect output_rect_;
+  // 最後に送ったフレーム。更新領域以外はここからコピーする
+  rtc::scoped_refptr<webrtc::I420Buffer> output_buffer_;
+  webrtc::VideoFrameBufferPool buffer_pool_;
+  int64_t last_sent_ms_ = 0;
+
+  // 更新領域の統計情報
+  int64_t stats_start_ms_ = 0;
+  int64_t stats_captured_frames_ = 0;
+  int64_t stats_sent_frames_ = 0;
+  int64_t stats_damaged_pixels_ = 0;
+  int64_t stats_total_pixels_ = 0;
+
+  // 次にキャプチャする時刻。処理の後に一定時間寝るのではなく、この時刻を基準にする
+  std::chrono::steady_clock::time_point next_capture_time_;
+  // キャプチャスレッドから変換スレッドに渡すフレーム。
+  // キャプチャ側はフレームのバッファを使い回すので、前のフレームの変換が終わって
+  // 破棄されるまで次のキャプチャはしない
+  std::mutex pending_mutex_;
+  std::condition_variable pending_cond_;
+  std::unique_ptr<webrtc::DesktopFrame> pending_frame_;
+  bool converting_ = false;
+  std::atomic<int> last_convert_duration_ms_;
+  // 続けて画面が変化しなかったフレームの数
+  std::atomic<int> unchanged_frames_;
+  rtc::PlatformThread convert_thread_;
   rtc::PlatformThread capture_thread_;
   std::unique_ptr<webrtc::DesktopCapturer> capturer_;
   std::atomic<bool> quit_;
@@ -1,20 +1,22 @@
 #include "sdl_renderer.h"
 
+#include <chrono>
 #include <cmath>
 #include <csignal>
 
 // WebRTC
-#include <api/video/i420_buffer.h>
 #include <rtc_base/logging.h>
-#include <third_party/libyuv/include/libyuv/convert_from.h>
-#include <third_party/libyuv/include/libyuv/video_common.h>
 
 #define STD_ASPECT 1.34
 #define WIDE_ASPECT 1.78
-#define FRAME_INTERVAL (1000 / 30)
+// 新しいフレームが来なくても、イベントの処理のためにこの間隔で起きる
+#define IDLE_INTERVAL 50
+// ディスプレイのリフレッシュレートが取得できなかった場合に使う
+#define DEFAULT_REFRESH_RATE 60
 
 SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
     : running_(true),
+      redraw_requested_(true),
       window_(nullptr),
       renderer_(nullptr),
       dispatch_(nullptr),
@@ -63,7 +65,11 @@ SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
 }
 
 SDLRenderer::~SDLRenderer() {
-  running_ = false;
+  {
+    std::lock_guard<std::mutex> lock(redraw_mutex_);
+    running_ = false;
+  }
+  redraw_cond_.notify_all();
   int ret = 0;
   SDL_WaitThread(thread_, &ret);
   if (ret != 0) {
@@ -178,65 +184,97 @@ int SDLRenderer::RenderThread() {
 
   SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255);
 
-  uint32_t start_time, duration;
+  Uint32 last_present_time = 0;
   while (running_) {
-    start_time = SDL_GetTicks();
+    // 新しいフレームが来るか、一定時間が経つまで待つ
+    bool redraw;
     {
-      webrtc::MutexLock lock(&sinks_lock_);
-      SDL_RenderClear(renderer_);
-      for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
-        Sink* sink = sinks.second.get();
-
-        webrtc::MutexLock frame_lock(sink->GetMutex());
-
-        if (!sink->GetOutlineChanged())
-          continue;
-
-        int width = sink->GetFrameWidth();
-        int height = sink->GetFrameHeight();
-
-        if (width == 0 || height == 0)
-          continue;
-
-        SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(
-            sink->GetImage(), width, height, 32, width * 4, 0, 0, 0, 0);
-        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer_, surface);
-        SDL_FreeSurface(surface);
-
-        SDL_Rect image_rect = {0, 0, width, height};
-        SDL_Rect draw_rect = {sink->GetOffsetX(), sink->GetOffsetY(),
-                              sink->GetWidth(), sink->GetHeight()};
+      std::unique_lock<std::mutex> lock(redraw_mutex_);
+      redraw = redraw_cond_.wait_for(
+          lock, std::chrono::milliseconds(IDLE_INTERVAL),
+          [this] { return redraw_requested_ || !running_; });
+    }
+    if (!running_) {
+      break;
+    }
+    // タイトルバーの表示中は、非表示にするためにも描画し続ける
+    redraw = redraw || show_title_bar_;
+
+    if (redraw) {
+      // ディスプレイのリフレッシュレートより速くは描画しない。
+      // 待っている間に来たフレームはまとめて描画する
+      Uint32 interval = GetRefreshInterval();
+      Uint32 elapsed = SDL_GetTicks() - last_present_time;
+      if (elapsed < interval) {
+        SDL_Delay(interval - elapsed);
+      }
+      {
+        std::lock_guard<std::mutex> lock(redraw_mutex_);
+        redraw_requested_ = false;
+      }
+    }
 
-        SDL_RenderCopy(renderer_, texture, &image_rect, &draw_rect);
+    {
+      webrtc::MutexLock lock(&sinks_lock_);
+      for (SDL_Texture* texture : released_textures_) {
         SDL_DestroyTexture(texture);
       }
-      SDL_RenderPresent(renderer_);
-
-      // Check if we need to show/hide title bar
-      // int x, y;
-      // SDL_GetMouseState(&x, &y);
-      // bool in_title_area = y < TITLE_BAR_HEIGHT;
-
-      // if (in_title_area) {
-      //   last_mouse_move_time_ = SDL_GetTicks();
-      //   if (!show_title_bar_) {
-      //     show_title_bar_ = true;
-      //   }
-      // } else if (show_title_bar_ &&
-      //            (SDL_GetTicks() - last_mouse_move_time_ > TITLE_SHOW_DELAY)) {
-      //   show_title_bar_ = false;
-      // }
-
-      if (show_title_bar_) {
-        UpdateTitleBar();
+      released_textures_.clear();
+
+      if (redraw) {
+        SDL_RenderClear(renderer_);
+        for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+          Sink* sink = sinks.second.get();
+
+          // シンクのロックは描画に必要な情報を取り出す間だけ取る
+          rtc::scoped_refptr<webrtc::I420BufferInterface> buffer;
+          SDL_Rect draw_rect;
+          webrtc::VideoRotation rotation;
+          {
+            webrtc::MutexLock frame_lock(sink->GetMutex());
+
+            if (!sink->GetOutlineChanged())
+              continue;
+
+            buffer = sink->TakeBuffer();
+            draw_rect = {sink->GetOffsetX(), sink->GetOffsetY(),
+                         sink->GetWidth(), sink->GetHeight()};
+            rotation = sink->GetRotation();
+          }
+
+          // 新しいフレームが来たシンクだけテクスチャを更新する。
+          // 色変換と拡大縮小は GPU で行う
+          SDL_Texture* texture = sink->UpdateTexture(renderer_, buffer);
+          if (texture == nullptr)
+            continue;
+
+          if (rotation == webrtc::kVideoRotation_90 ||
+              rotation == webrtc::kVideoRotation_270) {
+            // 回転は描画先の矩形の中心で行われるので、回転前の矩形を渡す
+            int width = draw_rect.w;
+            int height = draw_rect.h;
+            draw_rect.x += (width - height) / 2;
+            draw_rect.y += (height - width) / 2;
+            draw_rect.w = height;
+            draw_rect.h = width;
+          }
+
+          SDL_RenderCopyEx(renderer_, texture, nullptr, &draw_rect,
+                           static_cast<double>(rotation), nullptr,
+                           SDL_FLIP_NONE);
+        }
+        SDL_RenderPresent(renderer_);
+        last_present_time = SDL_GetTicks();
+
+        if (show_title_bar_) {
+          UpdateTitleBar();
+        }
       }
 
       if (dispatch_) {
         dispatch_(std::bind(&SDLRenderer::PollEvent, this));
       }
     }
-    duration = SDL_GetTicks() - start_time;
-    SDL_Delay(FRAME_INTERVAL - (duration % FRAME_INTERVAL));
   }
 
   SDL_DestroyRenderer(renderer_);
@@ -256,7 +294,10 @@ SDLRenderer::Sink::Sink(SDLRenderer* renderer,
       outline_changed_(false),
       input_width_(0),
       input_height_(0),
-      scaled_(false),
+      rotation_(webrtc::kVideoRotation_0),
+      texture_(nullptr),
+      texture_width_(0),
+      texture_height_(0),
       width_(0),
       height_(0) {
   track_->AddOrUpdateSink(this, rtc::VideoSinkWants());
@@ -271,11 +312,20 @@ void SDLRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
     return;
   if (frame.width() == 0 || frame.height() == 0)
     return;
+  // 色変換はせず、I420 のままレンダースレッドに渡す
+  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+      frame.video_frame_buffer()->ToI420();
+  if (!buffer)
+    return;
   webrtc::MutexLock lock(GetMutex());
   if (outline_changed_ || frame.width() != input_width_ ||
-      frame.height() != input_height_) {
+      frame.height() != input_height_ || frame.rotation() != rotation_) {
+    bool rotated = frame.rotation() == webrtc::kVideoRotation_90 ||
+                   frame.rotation() == webrtc::kVideoRotation_270;
+    int frame_width = rotated ? frame.height() : frame.width();
+    int frame_height = rotated ? frame.width() : frame.height();
     int width, height;
-    float frame_aspect = (float)frame.width() / (float)frame.height();
+    float frame_aspect = (float)frame_width / (float)frame_height;
     if (frame_aspect > outline_aspect_) {
       width = outline_width_;
       height = width / frame_aspect;
@@ -287,38 +337,16 @@ void SDLRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
       offset_x_ = (outline_width_ - width) / 2;
       offset_y_ = 0;
     }
-    if (width_ != width || height_ != height) {
-      width_ = width;
-      height_ = height;
-    }
+    width_ = width;
+    height_ = height;
     input_width_ = frame.width();
     input_height_ = frame.height();
-    scaled_ = width_ < input_width_;
-    if (scaled_) {
-      image_.reset(new uint8_t[width_ * height_ * 4]);
-    } else {
-      image_.reset(new uint8_t[input_width_ * input_height_ * 4]);
-    }
-    RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": scaled_=" << scaled_;
+    rotation_ = frame.rotation();
     outline_changed_ = false;
   }
-  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer_if;
-  if (scaled_) {
-    rtc::scoped_refptr<webrtc::I420Buffer> buffer =
-        webrtc::I420Buffer::Create(width_, height_);
-    buffer->ScaleFrom(*frame.video_frame_buffer()->ToI420());
-    if (frame.rotation() != webrtc::kVideoRotation_0) {
-      buffer = webrtc::I420Buffer::Rotate(*buffer, frame.rotation());
-    }
-    buffer_if = buffer;
-  } else {
-    buffer_if = frame.video_frame_buffer()->ToI420();
-  }
-  libyuv::ConvertFromI420(
-      buffer_if->DataY(), buffer_if->StrideY(), buffer_if->DataU(),
-      buffer_if->StrideU(), buffer_if->DataV(), buffer_if->StrideV(),
-      image_.get(), (scaled_ ? width_ : input_width_) * 4, buffer_if->width(),
-      buffer_if->height(), libyuv::FOURCC_ARGB);
+  // 描画が追いつかない場合は古いフレームを捨てる
+  buffer_ = std::move(buffer);
+  renderer_->RequestRedraw();
 }
 
 void SDLRenderer::Sink::SetOutlineRect(int x, int y, int width, int height) {
@@ -352,14 +380,6 @@ int SDLRenderer::Sink::GetOffsetY() {
   return outline_offset_y_ + offset_y_;
 }
 
-int SDLRenderer::Sink::GetFrameWidth() {
-  return scaled_ ? width_ : input_width_;
-}
-
-int SDLRenderer::Sink::GetFrameHeight() {
-  return scaled_ ? height_ : input_height_;
-}
-
 int SDLRenderer::Sink::GetWidth() {
   return width_;
 }
@@ -368,8 +388,71 @@ int SDLRenderer::Sink::GetHeight() {
   return height_;
 }
 
-uint8_t* SDLRenderer::Sink::GetImage() {
-  return image_.get();
+webrtc::VideoRotation SDLRenderer::Sink::GetRotation() {
+  return rotation_;
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface>
+SDLRenderer::Sink::TakeBuffer() {
+  return std::move(buffer_);
+}
+
+SDL_Texture* SDLRenderer::Sink::UpdateTexture(
+    SDL_Renderer* renderer,
+    const rtc::scoped_refptr<webrtc::I420BufferInterface>& buffer) {
+  if (!buffer) {
+    return texture_;
+  }
+  if (texture_ == nullptr || texture_width_ != buffer->width() ||
+      texture_height_ != buffer->height()) {
+    if (texture_ != nullptr) {
+      SDL_DestroyTexture(texture_);
+    }
+    texture_ =
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV,
+                          SDL_TEXTUREACCESS_STREAMING, buffer->width(),
+                          buffer->height());
+    if (texture_ == nullptr) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_CreateTexture failed "
+                        << SDL_GetError();
+      texture_width_ = 0;
+      texture_height_ = 0;
+      return nullptr;
+    }
+    texture_width_ = buffer->width();
+    texture_height_ = buffer->height();
+  }
+  if (SDL_UpdateYUVTexture(texture_, nullptr, buffer->DataY(),
+                           buffer->StrideY(), buffer->DataU(),
+                           buffer->StrideU(), buffer->DataV(),
+                           buffer->StrideV()) != 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_UpdateYUVTexture failed "
+                      << SDL_GetError();
+  }
+  return texture_;
+}
+
+SDL_Texture* SDLRenderer::Sink::ReleaseTexture() {
+  SDL_Texture* texture = texture_;
+  texture_ = nullptr;
+  return texture;
+}
+
+void SDLRenderer::RequestRedraw() {
+  {
+    std::lock_guard<std::mutex> lock(redraw_mutex_);
+    redraw_requested_ = true;
+  }
+  redraw_cond_.notify_one();
+}
+
+Uint32 SDLRenderer::GetRefreshInterval() {
+  int refresh_rate = DEFAULT_REFRESH_RATE;
+  SDL_DisplayMode mode;
+  if (SDL_GetWindowDisplayMode(window_, &mode) == 0 && mode.refresh_rate > 0) {
+    refresh_rate = mode.refresh_rate;
+  }
+  return 1000 / refresh_rate;
 }
 
 void SDLRenderer::SetOutlines() {
@@ -417,6 +500,7 @@ void SDLRenderer::SetOutlines() {
   }
   rows_ = rows;
   cols_ = cols;
+  RequestRedraw();
 }
 
 void SDLRenderer::AddTrack(webrtc::VideoTrackInterface* track) {
@@ -428,6 +512,14 @@ void SDLRenderer::AddTrack(webrtc::VideoTrackInterface* track) {
 
 void SDLRenderer::RemoveTrack(webrtc::VideoTrackInterface* track) {
   webrtc::MutexLock lock(&sinks_lock_);
+  for (const VideoTrackSinkVector::value_type& sink : sinks_) {
+    if (sink.first == track) {
+      SDL_Texture* texture = sink.second->ReleaseTexture();
+      if (texture != nullptr) {
+        released_textures_.push_back(texture);
+      }
+    }
+  }
   sinks_.erase(
       std::remove_if(sinks_.begin(), sinks_.end(),
                      [track](const VideoTrackSinkVector::value_type& sink) {
@@ -1,7 +1,9 @@
 #ifndef SDL_RENDERER_H_
 #define SDL_RENDERER_H_
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -62,11 +64,19 @@ class SDLRenderer : public VideoTrackReceiver {
     bool GetOutlineChanged();
     int GetOffsetX();
     int GetOffsetY();
-    int GetFrameWidth();
-    int GetFrameHeight();
     int GetWidth();
     int GetHeight();
-    uint8_t* GetImage();
+    webrtc::VideoRotation GetRotation();
+    // まだ描画していないフレームを取り出す。GetMutex() のロックを取った状態で呼ぶこと。
+    rtc::scoped_refptr<webrtc::I420BufferInterface> TakeBuffer();
+    // buffer があればテクスチャに転送して、描画するテクスチャを返す。
+    // テクスチャはレンダースレッドからしか触らないので、sinks_lock_ のロックを取った状態で呼ぶこと。
+    SDL_Texture* UpdateTexture(
+        SDL_Renderer* renderer,
+        const rtc::scoped_refptr<webrtc::I420BufferInterface>& buffer);
+    // テクスチャの所有権を手放す。テクスチャはレンダースレッドで破棄すること。
+    // sinks_lock_ のロックを取った状態で呼ぶこと。
+    SDL_Texture* ReleaseTexture();
 
    private:
     SDLRenderer* renderer_;
@@ -80,8 +90,13 @@ class SDLRenderer : public VideoTrackReceiver {
     float outline_aspect_;
     int input_width_;
     int input_height_;
-    bool scaled_;
-    std::unique_ptr<uint8_t[]> image_;
+    webrtc::VideoRotation rotation_;
+    // まだテクスチャに転送していないフレーム
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer_;
+    // IYUV のストリーミングテクスチャ。フレームのサイズが変わった時だけ作り直す
+    SDL_Texture* texture_;
+    int texture_width_;
+    int texture_height_;
     int offset_x_;
     int offset_y_;
     int width_;
@@ -89,12 +104,22 @@ class SDLRenderer : public VideoTrackReceiver {
   };
 
  private:
+  // 新しいフレームが来たり、レイアウトが変わった時に呼んで、レンダースレッドを起こす
+  void RequestRedraw();
+  // ディスプレイのリフレッシュレートでの 1 フレームの時間 (ミリ秒)
+  Uint32 GetRefreshInterval();
+
   webrtc::Mutex sinks_lock_;
   typedef std::vector<
       std::pair<webrtc::VideoTrackInterface*, std::unique_ptr<Sink> > >
       VideoTrackSinkVector;
   VideoTrackSinkVector sinks_;
+  // 削除されたトラックのテクスチャ。レンダースレッドで破棄する
+  std::vector<SDL_Texture*> released_textures_;
   std::atomic<bool> running_;
+  std::mutex redraw_mutex_;
+  std::condition_variable redraw_cond_;
+  bool redraw_requested_;
   SDL_Thread* thread_;
   SDL_Window* window_;
   SDL_Renderer* renderer_;
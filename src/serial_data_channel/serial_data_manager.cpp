@@ -3,17 +3,30 @@
 
 #include "serial_data_manager.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <iostream>
 
 // WebRTC
 #include <rtc_base/log_sinks.h>
+#include <rtc_base/logging.h>
 
 #define SERIAL_TX_BUFFER_SIZE 16
 #define SERIAL_RX_BUFFER_SIZE 256
+// 1 行がこのサイズを超える場合は、改行が無くてもそこまでを 1 行として送る
+#define SERIAL_RX_MAX_LINE_SIZE (1024 * 1024)
+// バイナリモードのフレームの長さのバイト数
+#define SERIAL_FRAME_HEADER_SIZE 2
 
-SerialDataManager::SerialDataManager(boost::asio::io_context& ioc)
-    : serial_port_(ioc), read_buffer_size_(SERIAL_RX_BUFFER_SIZE) {
+SerialDataManager::SerialDataManager(boost::asio::io_context& ioc,
+                                     SerialDataManagerConfig config)
+    : config_(config),
+      serial_port_(ioc),
+      read_buffer_(SERIAL_RX_BUFFER_SIZE * 16),
+      batch_timer_(ioc) {
   post_ = [&ioc](std::function<void()> f) {
     if (ioc.stopped())
       return;
@@ -29,6 +42,7 @@ SerialDataManager::~SerialDataManager() {
     }
   }
 
+  batch_timer_.cancel();
   DoCloseSerial();
 }
 
@@ -91,14 +105,28 @@ bool SerialDataManager::Connect(std::string device, unsigned int rate) {
     return false;
   }
 
-  read_buffer_.reset(new uint8_t[read_buffer_size_]);
   post_(std::bind(&SerialDataManager::DoRead, this));
   return true;
 }
 
-void SerialDataManager::Send(const uint8_t* data, size_t length) {
-  std::vector<uint8_t> v(data, data + length);
-  post_(std::bind(&SerialDataManager::StartWrite, this, std::move(v)));
+void SerialDataManager::Send(const rtc::CopyOnWriteBuffer& data) {
+  if (config_.framing == SerialDataManagerConfig::Framing::Binary) {
+    if (data.size() > 0xffff) {
+      RTC_LOG(LS_WARNING) << "Serial frame too large: size=" << data.size();
+      return;
+    }
+    uint8_t header[SERIAL_FRAME_HEADER_SIZE] = {
+        static_cast<uint8_t>(data.size() >> 8),
+        static_cast<uint8_t>(data.size() & 0xff)};
+    rtc::CopyOnWriteBuffer header_buffer(header, sizeof(header));
+    post_([this, header_buffer, data]() {
+      StartWrite(header_buffer);
+      StartWrite(data);
+    });
+    return;
+  }
+  // CopyOnWriteBuffer は参照カウントで共有されるので、ここではコピーされない
+  post_(std::bind(&SerialDataManager::StartWrite, this, data));
 }
 
 void SerialDataManager::DoCloseSerial() {
@@ -114,8 +142,22 @@ void SerialDataManager::DoRead() {
   if (!serial_port_.is_open()) {
     return;
   }
+  // 末尾に空きが無くなったら、未処理のデータを先頭に詰める
+  if (read_buffer_.size() - read_tail_ < SERIAL_RX_BUFFER_SIZE) {
+    if (read_head_ > 0) {
+      memmove(read_buffer_.data(), read_buffer_.data() + read_head_,
+              read_tail_ - read_head_);
+      read_tail_ -= read_head_;
+      scan_pos_ -= read_head_;
+      read_head_ = 0;
+    }
+    if (read_buffer_.size() - read_tail_ < SERIAL_RX_BUFFER_SIZE) {
+      read_buffer_.resize(read_buffer_.size() * 2);
+    }
+  }
   serial_port_.async_read_some(
-      boost::asio::buffer(read_buffer_.get(), read_buffer_size_),
+      boost::asio::buffer(read_buffer_.data() + read_tail_,
+                          read_buffer_.size() - read_tail_),
       std::bind(&SerialDataManager::OnRead, this, std::placeholders::_1,
                 std::placeholders::_2));
 }
@@ -128,48 +170,150 @@ void SerialDataManager::OnRead(const boost::system::error_code& error,
     DoCloseSerial();
     return;
   }
-  read_line_buffer_.insert(read_line_buffer_.end(), read_buffer_.get(),
-                           read_buffer_.get() + bytes_transferred);
+  read_tail_ += bytes_transferred;
   {
     webrtc::MutexLock lock(&channels_lock_);
-    SendLineFromSerial();
+    SendFromSerial();
   }
   DoRead();
 }
 
-void SerialDataManager::SendLineFromSerial() {
-  auto delimiter_iterator =
-      std::find(read_line_buffer_.begin(), read_line_buffer_.end(), '\n');
-  if (delimiter_iterator != read_line_buffer_.end()) {
-    size_t delimiter_index =
-        std::distance(read_line_buffer_.begin(), delimiter_iterator);
-    for (SerialDataChannel* serial_data_channel : serial_data_channels_) {
-      serial_data_channel->Send(read_line_buffer_.data(), delimiter_index);
+void SerialDataManager::SendFromSerial() {
+  const uint8_t* data = read_buffer_.data();
+  if (config_.framing == SerialDataManagerConfig::Framing::Binary) {
+    while (read_tail_ - read_head_ >= SERIAL_FRAME_HEADER_SIZE) {
+      size_t length = (data[read_head_] << 8) | data[read_head_ + 1];
+      if (read_tail_ - read_head_ < SERIAL_FRAME_HEADER_SIZE + length) {
+        break;
+      }
+      SendMessage(data + read_head_ + SERIAL_FRAME_HEADER_SIZE, length);
+      read_head_ += SERIAL_FRAME_HEADER_SIZE + length;
+    }
+    scan_pos_ = read_head_;
+  } else {
+    // memchr は SIMD で実装されているので、1 バイトずつ比較するより速い
+    while (scan_pos_ < read_tail_) {
+      const uint8_t* delimiter = static_cast<const uint8_t*>(
+          memchr(data + scan_pos_, '\n', read_tail_ - scan_pos_));
+      if (delimiter == nullptr) {
+        scan_pos_ = read_tail_;
+        break;
+      }
+      size_t delimiter_index = delimiter - data;
+      SendMessage(data + read_head_, delimiter_index - read_head_);
+      read_head_ = delimiter_index + 1;
+      scan_pos_ = read_head_;
+    }
+    // 改行が来ないまま大きくなりすぎた場合は、そこまでを 1 行として送る
+    if (read_tail_ - read_head_ >= SERIAL_RX_MAX_LINE_SIZE) {
+      SendMessage(data + read_head_, read_tail_ - read_head_);
+      read_head_ = read_tail_;
+      scan_pos_ = read_tail_;
+    }
+  }
+  if (read_head_ == read_tail_) {
+    read_head_ = 0;
+    read_tail_ = 0;
+    scan_pos_ = 0;
+  }
+  // 長い行や大きなフレームのために広げたバッファは、空になったら元に戻す
+  if (read_buffer_.size() > SERIAL_RX_BUFFER_SIZE * 16 && read_head_ == 0 &&
+      read_tail_ == 0) {
+    read_buffer_.resize(SERIAL_RX_BUFFER_SIZE * 16);
+    read_buffer_.shrink_to_fit();
+  }
+  if (config_.batch_max_bytes == 0 || batch_messages_ == 0) {
+    return;
+  }
+  if (batch_.size() >= config_.batch_max_bytes) {
+    FlushBatch();
+  } else if (!batch_timer_running_) {
+    batch_timer_running_ = true;
+    batch_timer_.expires_after(
+        std::chrono::milliseconds(config_.batch_max_delay_ms));
+    batch_timer_.async_wait(std::bind(&SerialDataManager::OnBatchTimer, this,
+                                      std::placeholders::_1));
+  }
+}
+
+void SerialDataManager::SendMessage(const uint8_t* data, size_t length) {
+  if (config_.batch_max_bytes == 0) {
+    SendToChannels(rtc::CopyOnWriteBuffer(data, length));
+    return;
+  }
+  if (config_.framing == SerialDataManagerConfig::Framing::Binary) {
+    // まとめたメッセージの中でも区切れるように、長さを付けたまま送る
+    uint8_t header[SERIAL_FRAME_HEADER_SIZE] = {
+        static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length & 0xff)};
+    if (batch_messages_ > 0 &&
+        batch_.size() + sizeof(header) + length > config_.batch_max_bytes) {
+      FlushBatch();
+    }
+    batch_.AppendData(header, sizeof(header));
+  } else {
+    if (batch_messages_ > 0 &&
+        batch_.size() + 1 + length > config_.batch_max_bytes) {
+      FlushBatch();
     }
-    read_line_buffer_.erase(read_line_buffer_.begin(), delimiter_iterator + 1);
-    SendLineFromSerial();
+    // 空の行も区切れるように、バイト数ではなく行数で区切りを入れるか決める
+    if (batch_messages_ > 0) {
+      batch_.AppendData("\n", 1);
+    }
+  }
+  batch_.AppendData(data, length);
+  batch_messages_++;
+}
+
+void SerialDataManager::FlushBatch() {
+  if (batch_timer_running_) {
+    batch_timer_.cancel();
+    batch_timer_running_ = false;
+  }
+  if (batch_messages_ == 0) {
+    return;
+  }
+  SendToChannels(batch_);
+  // 送ったバッファはデータチャネル側と共有しているので、新しいバッファを使う
+  batch_ = rtc::CopyOnWriteBuffer(0, config_.batch_max_bytes);
+  batch_messages_ = 0;
+}
+
+void SerialDataManager::OnBatchTimer(const boost::system::error_code& error) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  batch_timer_running_ = false;
+  webrtc::MutexLock lock(&channels_lock_);
+  FlushBatch();
+}
+
+void SerialDataManager::SendToChannels(const rtc::CopyOnWriteBuffer& buffer) {
+  for (SerialDataChannel* serial_data_channel : serial_data_channels_) {
+    serial_data_channel->Send(buffer);
   }
 }
 
-void SerialDataManager::StartWrite(std::vector<uint8_t> v) {
+void SerialDataManager::StartWrite(rtc::CopyOnWriteBuffer data) {
   if (!serial_port_.is_open()) {
     return;
   }
-  bool empty = write_buffer_.empty();
-  write_buffer_.insert(write_buffer_.end(), v.begin(), v.end());
-  if (empty && !write_buffer_.empty()) {
+  if (data.size() == 0) {
+    return;
+  }
+  bool empty = write_queue_.empty();
+  write_queue_.push_back(std::move(data));
+  if (empty) {
     DoWrite();
   }
 }
 
 void SerialDataManager::DoWrite() {
-  if (write_buffer_.size() < SERIAL_TX_BUFFER_SIZE) {
-    write_length_ = write_buffer_.size();
-  } else {
-    write_length_ = SERIAL_TX_BUFFER_SIZE;
-  }
+  const rtc::CopyOnWriteBuffer& front = write_queue_.front();
+  write_length_ =
+      std::min<size_t>(front.size() - write_offset_, SERIAL_TX_BUFFER_SIZE);
   async_write(
-      serial_port_, boost::asio::buffer(write_buffer_.data(), write_length_),
+      serial_port_,
+      boost::asio::buffer(front.cdata() + write_offset_, write_length_),
       std::bind(&SerialDataManager::OnWrite, this, std::placeholders::_1));
 }
 
@@ -180,9 +324,12 @@ void SerialDataManager::OnWrite(const boost::system::error_code& error) {
     DoCloseSerial();
     return;
   }
-  write_buffer_.erase(write_buffer_.begin(),
-                      write_buffer_.begin() + write_length_);
-  if (write_buffer_.empty()) {
+  write_offset_ += write_length_;
+  if (write_offset_ >= write_queue_.front().size()) {
+    write_queue_.pop_front();
+    write_offset_ = 0;
+  }
+  if (write_queue_.empty()) {
     return;
   }
   DoWrite();
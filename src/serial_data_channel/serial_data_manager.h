@@ -1,6 +1,7 @@
 #ifndef SERIAL_DATA_MANAGER_H_
 #define SERIAL_DATA_MANAGER_H_
 
+#include <deque>
 #include <memory>
 #include <vector>
 
@@ -8,6 +9,7 @@
 #include <boost/asio.hpp>
 
 // WebRTC
+#include <rtc_base/copy_on_write_buffer.h>
 #include <rtc_base/synchronization/mutex.h>
 
 #include "rtc/rtc_data_manager.h"
@@ -15,12 +17,30 @@
 
 class SerialDataChannel;
 
+struct SerialDataManagerConfig {
+  enum class Framing {
+    // 改行区切り。改行を除いた 1 行を 1 つのメッセージとして送る
+    Line,
+    // 2 バイトのビッグエンディアンの長さ + データ。
+    // データチャネルからのメッセージも長さを付けてシリアルに書き込む
+    Binary,
+  };
+  Framing framing = Framing::Line;
+  // 0 より大きい場合は、複数の行（フレーム）をこのサイズまで 1 つのメッセージにまとめて送る
+  size_t batch_max_bytes = 0;
+  // まとめて送る場合に、最初の行（フレーム）を受け取ってから送るまでの最大の待ち時間
+  int batch_max_delay_ms = 10;
+};
+
 class SerialDataManager : public RTCDataManager {
  public:
-  static std::unique_ptr<SerialDataManager> Create(boost::asio::io_context& ioc,
-                                                   std::string device,
-                                                   unsigned int rate) {
-    std::unique_ptr<SerialDataManager> data_manager(new SerialDataManager(ioc));
+  static std::unique_ptr<SerialDataManager> Create(
+      boost::asio::io_context& ioc,
+      std::string device,
+      unsigned int rate,
+      SerialDataManagerConfig config = SerialDataManagerConfig()) {
+    std::unique_ptr<SerialDataManager> data_manager(
+        new SerialDataManager(ioc, config));
     if (!data_manager->Connect(device, rate)) {
       return nullptr;
     }
@@ -28,34 +48,54 @@ class SerialDataManager : public RTCDataManager {
   }
   ~SerialDataManager();
 
-  void Send(const uint8_t* data, size_t length);
+  void Send(const rtc::CopyOnWriteBuffer& data);
 
   void OnDataChannel(
       rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
   void OnClosed(SerialDataChannel* serial_data_channel);
 
  private:
-  SerialDataManager(boost::asio::io_context& ioc);
+  SerialDataManager(boost::asio::io_context& ioc,
+                    SerialDataManagerConfig config);
   bool Connect(std::string device, unsigned int rate);
   void DoCloseSerial();
   void DoRead();
   void OnRead(const boost::system::error_code& error, size_t bytes_transferred);
-  void SendLineFromSerial();
-  void StartWrite(std::vector<uint8_t> v);
+  // 受信バッファから完成した行（フレーム）を全て取り出して送る
+  void SendFromSerial();
+  void SendMessage(const uint8_t* data, size_t length);
+  void FlushBatch();
+  void OnBatchTimer(const boost::system::error_code& error);
+  void SendToChannels(const rtc::CopyOnWriteBuffer& buffer);
+  void StartWrite(rtc::CopyOnWriteBuffer data);
   void DoWrite();
   void OnWrite(const boost::system::error_code& error);
 
+  SerialDataManagerConfig config_;
   boost::asio::serial_port serial_port_;
   std::function<void(std::function<void()>)> post_;
   webrtc::Mutex channels_lock_;
   std::vector<SerialDataChannel*> serial_data_channels_;
 
-  std::unique_ptr<uint8_t[]> read_buffer_;
-  size_t read_buffer_size_;
-  std::vector<uint8_t> read_line_buffer_;
+  // 受信バッファ。[read_head_, read_tail_) が未処理のデータで、
+  // シリアルからは read_tail_ 以降に直接読み込む。
+  // 末尾まで使い切った時だけ未処理のデータを先頭に詰めるので、1 行毎に前を消す必要が無い
+  std::vector<uint8_t> read_buffer_;
+  size_t read_head_ = 0;
+  size_t read_tail_ = 0;
+  // 改行を探し終わった位置。続きのデータが来た時にここから探す
+  size_t scan_pos_ = 0;
+
+  rtc::CopyOnWriteBuffer batch_;
+  // batch_ に入っているメッセージの数。空の行だけのバッチもあるので、バイト数とは別に数える
+  size_t batch_messages_ = 0;
+  boost::asio::steady_timer batch_timer_;
+  bool batch_timer_running_ = false;
 
-  std::vector<uint8_t> write_buffer_;
-  size_t write_length_;
+  // シリアルに書き込むデータ。データチャネルから受け取ったバッファをコピーせずに積む
+  std::deque<rtc::CopyOnWriteBuffer> write_queue_;
+  size_t write_offset_ = 0;
+  size_t write_length_ = 0;
 };
 
 #endif
@@ -25,7 +25,9 @@ class NvCodecV4L2Capturer : public V4L2VideoCapturer {
       const NvCodecV4L2CapturerConfig& config,
       size_t capture_device_index);
 
-  void OnCaptured(uint8_t* data, uint32_t bytesused) override;
+  void OnCaptured(uint8_t* data,
+                  uint32_t bytesused,
+                  int64_t timestamp_us) override;
 
   std::shared_ptr<NvCodecDecoderCuda> decoder_;
 };
@@ -15,9 +15,12 @@ class VplVideoEncoder : public webrtc::VideoEncoder {
  public:
   static bool IsSupported(std::shared_ptr<VplSession> session,
                           webrtc::VideoCodecType codec);
+  // async_depth が 2 以上の場合は、複数のフレームを同時にエンコードする。
+  // Encode はエンコードの完了を待たずに戻り、OnEncodedImage は別のスレッドからエンコードした順に呼ばれる。
   static std::unique_ptr<VplVideoEncoder> Create(
       std::shared_ptr<VplSession> session,
-      webrtc::VideoCodecType codec);
+      webrtc::VideoCodecType codec,
+      int async_depth = 1);
 };
 
 }  // namespace sora
@@ -10,9 +10,12 @@
 
 namespace sora {
 
+// max_threads はエンコードに使う最大のスレッド数。
+// 1 の場合はシングルスレッドでエンコードし、0 の場合は CPU のコア数と解像度から自動で決める。
 std::unique_ptr<webrtc::VideoEncoder> CreateOpenH264VideoEncoder(
     const webrtc::SdpVideoFormat& format,
-    std::string openh264);
+    std::string openh264,
+    int max_threads = 1);
 
 }
 
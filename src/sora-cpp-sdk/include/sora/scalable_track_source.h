@@ -12,13 +12,18 @@
 
 #include <stddef.h>
 
+#include <atomic>
+#include <map>
 #include <memory>
 
 // WebRTC
 #include <media/base/adapted_video_track_source.h>
 #include <media/base/video_adapter.h>
+#include <rtc_base/synchronization/mutex.h>
 #include <rtc_base/timestamp_aligner.h>
 
+#include "sora/scaled_buffer_cache.h"
+
 namespace sora {
 
 struct ScalableVideoTrackSourceConfig {
@@ -35,10 +40,43 @@ class ScalableVideoTrackSource : public rtc::AdaptedVideoTrackSource {
   webrtc::MediaSourceInterface::SourceState state() const override;
   bool remote() const override;
   bool OnCapturedFrame(const webrtc::VideoFrame& frame);
+  // frame.timestamp_us() が ToCaptureTimestampUs() で得たキャプチャ時刻の場合に使う。
+  // TimestampAligner で補正せず、そのままフレームのタイムスタンプとして扱う。
+  bool OnCapturedFrameWithCaptureTime(const webrtc::VideoFrame& frame);
+
+  void AddOrUpdateSink(rtc::VideoSinkInterface<webrtc::VideoFrame>* sink,
+                       const rtc::VideoSinkWants& wants) override;
+  void RemoveSink(rtc::VideoSinkInterface<webrtc::VideoFrame>* sink) override;
+
+ protected:
+  // 全てのシンクから要求された max_framerate_fps の中で一番小さい値。
+  // 要求が無い場合は std::numeric_limits<int>::max() になる
+  int max_framerate_fps() const;
+
+  // カーネルやセンサーのキャプチャ時刻 (rtc::TimeMicros() と同じ時計) を
+  // フレームのタイムスタンプに変換する。キャプチャスレッドからのみ呼ぶこと。
+  // キャプチャ時刻が無いフレーム (capture_time_us < 0) は、直前のフレームの
+  // キャプチャからの遅延を今の時刻から引いて、ストリーム内で同じ時計の時刻になるようにする。
+  // 戻り値は単調増加になる。
+  int64_t ToCaptureTimestampUs(int64_t capture_time_us);
 
  private:
+  bool OnCapturedFrameInternal(const webrtc::VideoFrame& frame,
+                               bool align_timestamp);
+  void UpdateMaxFramerate() RTC_EXCLUSIVE_LOCKS_REQUIRED(sinks_mutex_);
+
   ScalableVideoTrackSourceConfig config_;
   rtc::TimestampAligner timestamp_aligner_;
+  std::shared_ptr<ScaledBufferCache> scaled_buffer_cache_;
+
+  webrtc::Mutex sinks_mutex_;
+  std::map<rtc::VideoSinkInterface<webrtc::VideoFrame>*, int>
+      sink_max_framerates_ RTC_GUARDED_BY(sinks_mutex_);
+  std::atomic<int> max_framerate_fps_;
+
+  // ToCaptureTimestampUs 用の状態。まだ無い場合は -1
+  int64_t last_capture_timestamp_us_ = -1;
+  int64_t capture_delay_us_ = -1;
 };
 
 }  // namespace sora
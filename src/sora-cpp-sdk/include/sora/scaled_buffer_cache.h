@@ -0,0 +1,87 @@
+#ifndef SORA_SCALED_BUFFER_CACHE_H_
+#define SORA_SCALED_BUFFER_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame_buffer.h>
+#include <common_video/include/video_frame_buffer_pool.h>
+#include <rtc_base/synchronization/mutex.h>
+
+namespace sora {
+
+// サイマルキャストでは同じフレームを複数の解像度に縮小するので、
+// 縮小したバッファを解像度毎にキャッシュして使い回すための状態。
+// ソースとエンコーダのスレッドから触るので、スレッドセーフになっている。
+class ScaledBufferCache {
+ public:
+  // これ以上のフレームの間使われなかった解像度は、プールを破棄する
+  static constexpr int kMaxIdleFrames = 30;
+
+  // 縮小後のバッファをプールから取得する
+  rtc::scoped_refptr<webrtc::I420Buffer> CreateI420Buffer(int width,
+                                                          int height);
+  // 新しいフレームが来た時に呼ぶ。
+  // しばらく使われていない解像度のプールを破棄する。
+  void NextFrame();
+
+ private:
+  struct Entry {
+    int64_t last_used_frame = 0;
+    std::unique_ptr<webrtc::VideoFrameBufferPool> pool;
+  };
+
+  webrtc::Mutex mutex_;
+  int64_t frame_count_ RTC_GUARDED_BY(mutex_) = 0;
+  std::map<std::pair<int, int>, Entry> entries_ RTC_GUARDED_BY(mutex_);
+};
+
+// I420 バッファをラップして、全体を縮小する CropAndScale の結果をフレーム内でキャッシュする。
+// 縮小はその解像度が最初に要求された時に行い、画質を落とさないように常に元のバッファから縮小する。
+class PyramidI420Buffer : public webrtc::I420BufferInterface {
+ public:
+  static rtc::scoped_refptr<PyramidI420Buffer> Create(
+      rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+      std::shared_ptr<ScaledBufferCache> cache);
+
+  int width() const override;
+  int height() const override;
+  const uint8_t* DataY() const override;
+  const uint8_t* DataU() const override;
+  const uint8_t* DataV() const override;
+  int StrideY() const override;
+  int StrideU() const override;
+  int StrideV() const override;
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> CropAndScale(
+      int offset_x,
+      int offset_y,
+      int crop_width,
+      int crop_height,
+      int scaled_width,
+      int scaled_height) override;
+
+ protected:
+  PyramidI420Buffer(rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+                    std::shared_ptr<ScaledBufferCache> cache);
+
+ private:
+  rtc::scoped_refptr<webrtc::I420BufferInterface> GetOrScale(int width,
+                                                             int height)
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer_;
+  std::shared_ptr<ScaledBufferCache> cache_;
+  webrtc::Mutex mutex_;
+  std::vector<rtc::scoped_refptr<webrtc::I420BufferInterface>> levels_
+      RTC_GUARDED_BY(mutex_);
+};
+
+}  // namespace sora
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef SORA_V4L2_MJPEG_PARALLEL_DECODER_H_
+#define SORA_V4L2_MJPEG_PARALLEL_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// WebRTC
+#include <api/video/i420_buffer.h>
+#include <rtc_base/platform_thread.h>
+
+namespace sora {
+
+// data の末尾 search_size バイトから最後の EOI マーカー (0xFFD9) を探し、
+// EOI の直後までのサイズを返す。見つからなかった場合は size を返す。
+// V4L2 の bytesused にはアライメントのためのパディングが含まれることがあるので、その除去に使う。
+size_t FindMjpegEndOfImage(const uint8_t* data,
+                           size_t size,
+                           size_t search_size);
+
+// リスタートマーカーを含む MJPEG を、MCU 行単位のスライスに分けて複数のスレッドでデコードする。
+// 各スライスはヘッダをコピーした独立した JPEG として libyuv でデコードする。
+class MjpegParallelDecoder {
+ public:
+  static std::unique_ptr<MjpegParallelDecoder> Create(int num_threads);
+  ~MjpegParallelDecoder();
+
+  // dst にデコードする。
+  // リスタートマーカーが無い、プログレッシブ JPEG であるなど、並列にデコードできない場合は
+  // false を返すので、呼び出し側で通常のデコードを行うこと。
+  bool Decode(const uint8_t* data, size_t size, webrtc::I420Buffer* dst);
+
+ private:
+  MjpegParallelDecoder() = default;
+  void Run();
+
+  int num_threads_ = 0;
+  std::vector<rtc::PlatformThread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable done_cond_;
+  std::deque<std::function<void()>> tasks_;
+  int pending_ = 0;
+  bool quit_ = false;
+
+  // スライス毎の JPEG データ。フレーム毎に確保しないように使い回す
+  std::vector<std::vector<uint8_t>> slices_;
+  std::vector<size_t> restart_markers_;
+};
+
+}  // namespace sora
+
+#endif
@@ -14,15 +14,22 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <memory>
 
+// Linux
+#include <linux/videodev2.h>
+
 // WebRTC
+#include <api/video/i420_buffer.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <modules/video_capture/video_capture_defines.h>
 #include <modules/video_capture/video_capture_impl.h>
 #include <rtc_base/platform_thread.h>
 #include <rtc_base/synchronization/mutex.h>
 
 #include "sora/scalable_track_source.h"
+#include "sora/v4l2/mjpeg_parallel_decoder.h"
 
 namespace sora {
 
@@ -33,6 +40,14 @@ struct V4L2VideoCapturerConfig : ScalableVideoTrackSourceConfig {
   int framerate = 30;
   bool force_i420 = false;
   bool use_native = false;
+  // V4L2 に要求するキャプチャバッファの数
+  int buffer_count = 4;
+  // I420/YV12/NV12 でキャプチャしている場合、V4L2 のバッファをコピーせずに
+  // そのままフレームとして渡し、フレームが解放された時点でキューに戻す
+  bool zero_copy = false;
+  // MJPEG でキャプチャしている場合に、ソフトウェアデコードに使うスレッドの数。
+  // 2 以上の場合、リスタートマーカーを含む JPEG をスライスに分けて並列にデコードする
+  int mjpeg_decode_threads = 1;
 };
 
 class V4L2VideoCapturer : public ScalableVideoTrackSource {
@@ -47,11 +62,32 @@ class V4L2VideoCapturer : public ScalableVideoTrackSource {
   int32_t Init(const char* deviceUniqueId);
   virtual int32_t StartCapture(const V4L2VideoCapturerConfig& config);
 
+  // OnCaptured で利用するフレームバッファプールのヒット数/ミス数。
+  // プールからバッファを取得できた場合をヒット、プールを使い切ってその場で確保した場合をミスとする
+  struct BufferPoolStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+  BufferPoolStats GetBufferPoolStats() const;
+
+  // v4l2_buffer のタイムスタンプ (CLOCK_MONOTONIC) をマイクロ秒で返す。
+  // ドライバが CLOCK_MONOTONIC のタイムスタンプを設定していない場合や、
+  // 値がおかしい場合は -1 を返す。
+  // フレームのタイムスタンプには ToCaptureTimestampUs() で変換してから使う。
+  static int64_t GetCaptureTimestampUs(const v4l2_buffer& buf);
+
  protected:
   virtual int32_t StopCapture();
   virtual bool AllocateVideoBuffers();
   virtual bool DeAllocateVideoBuffers();
-  virtual void OnCaptured(uint8_t* data, uint32_t bytesused);
+  // timestamp_us はカーネルがフレームを受け取った時刻 (rtc::TimeMicros() と同じ時計)
+  virtual void OnCaptured(uint8_t* data,
+                          uint32_t bytesused,
+                          int64_t timestamp_us);
+  // プールから I420 バッファを取得する。
+  // ConvertToI420 で全て上書きするので、バッファの初期化はしない。
+  rtc::scoped_refptr<webrtc::I420Buffer> CreateI420Buffer(int width,
+                                                          int height);
 
   int32_t _deviceFd;
   int32_t _currentWidth;
@@ -70,11 +106,23 @@ class V4L2VideoCapturer : public ScalableVideoTrackSource {
       const V4L2VideoCapturerConfig& config,
       size_t capture_device_index);
   bool FindDevice(const char* deviceUniqueIdUTF8, const std::string& device);
+  // V4L2 のバッファを参照するフレームを作って OnCapturedFrame に渡す。
+  // バッファの所有権をフレームに渡した場合は true を返す。
+  bool OnCapturedZeroCopy(const v4l2_buffer& buf);
+
+  // ゼロコピー時に、ドライバ側に最低限残しておくバッファの数
+  enum { kMinQueuedV4L2Buffers = 2 };
+  // キャプチャ停止時に、ゼロコピーのフレームが解放されるのを待つ最大時間
+  enum { kZeroCopyReleaseTimeoutMs = 1000 };
 
-  enum { kNoOfV4L2Bufffers = 4 };
+  // ゼロコピーのフレームが V4L2 のバッファを参照している間、
+  // mmap した領域を生かしておくための共有状態
+  struct ZeroCopyState;
 
   static void CaptureThread(void*);
   bool CaptureProcess();
+  // バッファを 1 つ取り出して処理する
+  void ProcessCapturedBuffer() RTC_EXCLUSIVE_LOCKS_REQUIRED(capture_lock_);
 
   rtc::PlatformThread _captureThread;
   webrtc::Mutex capture_lock_;
@@ -82,8 +130,17 @@ class V4L2VideoCapturer : public ScalableVideoTrackSource {
   std::string _videoDevice;
 
   int32_t _buffersAllocatedByDevice;
+  int32_t _bufferCount;
+  int32_t _bytesPerLine;
   bool _useNative;
+  bool _useZeroCopy;
   bool _captureStarted;
+  std::shared_ptr<ZeroCopyState> zero_copy_state_;
+  std::unique_ptr<MjpegParallelDecoder> mjpeg_decoder_;
+
+  webrtc::VideoFrameBufferPool buffer_pool_;
+  std::atomic<uint64_t> buffer_pool_hits_;
+  std::atomic<uint64_t> buffer_pool_misses_;
 };
 
 }  // namespace sora
@@ -546,7 +546,8 @@ bool JetsonV4L2Capturer::CaptureProcess() {
 }
 
 void JetsonV4L2Capturer::OnCaptured(v4l2_buffer* buf) {
-  const int64_t timestamp_us = rtc::TimeMicros();
+  const int64_t timestamp_us =
+      ToCaptureTimestampUs(V4L2VideoCapturer::GetCaptureTimestampUs(*buf));
   int adapted_width, adapted_height, crop_width, crop_height, crop_x, crop_y;
   if (!AdaptFrame(_currentWidth, _currentHeight, timestamp_us, &adapted_width,
                   &adapted_height, &crop_width, &crop_height, &crop_x,
@@ -593,8 +594,8 @@ void JetsonV4L2Capturer::OnCaptured(v4l2_buffer* buf) {
     OnFrame(webrtc::VideoFrame::Builder()
                 .set_video_frame_buffer(jetson_buffer)
                 .set_timestamp_rtp(0)
-                .set_timestamp_ms(rtc::TimeMillis())
-                .set_timestamp_us(rtc::TimeMicros())
+                .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+                .set_timestamp_us(timestamp_us)
                 .set_rotation(webrtc::kVideoRotation_0)
                 .build());
   } else {
@@ -604,8 +605,8 @@ void JetsonV4L2Capturer::OnCaptured(v4l2_buffer* buf) {
     OnFrame(webrtc::VideoFrame::Builder()
                 .set_video_frame_buffer(jetson_buffer)
                 .set_timestamp_rtp(0)
-                .set_timestamp_ms(rtc::TimeMillis())
-                .set_timestamp_us(rtc::TimeMicros())
+                .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+                .set_timestamp_us(timestamp_us)
                 .set_rotation(webrtc::kVideoRotation_0)
                 .build());
   }
@@ -78,8 +78,9 @@ rtc::scoped_refptr<V4L2VideoCapturer> NvCodecV4L2Capturer::Create(
   return v4l2_capturer;
 }
 
-void NvCodecV4L2Capturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
-  const int64_t timestamp_us = rtc::TimeMicros();
+void NvCodecV4L2Capturer::OnCaptured(uint8_t* data,
+                                     uint32_t bytesused,
+                                     int64_t timestamp_us) {
   int adapted_width, adapted_height, crop_width, crop_height, crop_x, crop_y;
   if (!AdaptFrame(_currentWidth, _currentHeight, timestamp_us, &adapted_width,
                   &adapted_height, &crop_width, &crop_height, &crop_x,
@@ -113,8 +114,8 @@ void NvCodecV4L2Capturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
     OnFrame(webrtc::VideoFrame::Builder()
                 .set_video_frame_buffer(buf)
                 .set_timestamp_rtp(0)
-                .set_timestamp_ms(rtc::TimeMillis())
-                .set_timestamp_us(rtc::TimeMicros())
+                .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+                .set_timestamp_us(timestamp_us)
                 .set_rotation(webrtc::kVideoRotation_0)
                 .build());
   }
@@ -1,7 +1,11 @@
 #include "sora/hwenc_vpl/vpl_video_encoder.h"
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <thread>
 
 // WebRTC
 #include <common_video/h264/h264_bitstream_parser.h>
@@ -13,6 +17,7 @@
 #include <modules/video_coding/include/video_error_codes.h>
 #include <modules/video_coding/utility/vp9_uncompressed_header_parser.h>
 #include <rtc_base/logging.h>
+#include <rtc_base/platform_thread.h>
 #include <rtc_base/synchronization/mutex.h>
 
 // Intel VPL
@@ -29,7 +34,9 @@ namespace sora {
 
 class VplVideoEncoderImpl : public VplVideoEncoder {
  public:
-  VplVideoEncoderImpl(std::shared_ptr<VplSession> session, mfxU32 codec);
+  VplVideoEncoderImpl(std::shared_ptr<VplSession> session,
+                      mfxU32 codec,
+                      int async_depth);
   ~VplVideoEncoderImpl() override;
 
   int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
@@ -52,6 +59,7 @@ class VplVideoEncoderImpl : public VplVideoEncoder {
       int framerate,
       int target_kbps,
       int max_kbps,
+      int async_depth,
       bool init);
 
  private:
@@ -69,9 +77,35 @@ class VplVideoEncoderImpl : public VplVideoEncoder {
                            int framerate,
                            int target_kbps,
                            int max_kbps,
+                           int async_depth,
                            mfxVideoParam& param,
                            ExtBuffer& ext);
 
+  // エンコード結果の出力先。エンコード中のフレーム毎に 1 つ使う
+  struct OutputSlot {
+    std::vector<uint8_t> buffer;
+    mfxBitstream bitstream;
+    mfxSyncPoint syncp;
+  };
+  // エンコード結果を作るために、入力フレームから引き継ぐ値
+  struct FrameParams {
+    uint32_t rtp_timestamp;
+    int64_t ntp_time_ms;
+    int64_t render_time_ms;
+    webrtc::VideoRotation rotation;
+    absl::optional<webrtc::ColorSpace> color_space;
+  };
+
+  // 空いている出力先を取り出す。全て使用中の場合はエンコードが終わるまで待つ
+  OutputSlot* AcquireSlot();
+  void ReleaseSlot(OutputSlot* slot);
+  // エンコード中のフレームが全て終わるまで待つ
+  void WaitForPendingFrames();
+  // エンコードが終わったフレームを OnEncodedImage で渡す
+  int32_t DeliverEncodedImage(OutputSlot* slot);
+  // async_depth_ が 2 以上の場合に、エンコードの完了を順番に待って結果を渡すスレッド
+  void CompletionThread();
+
  private:
   std::mutex mutex_;
   webrtc::EncodedImageCallback* callback_ = nullptr;
@@ -101,17 +135,31 @@ class VplVideoEncoderImpl : public VplVideoEncoder {
   mfxU32 codec_;
   mfxFrameAllocRequest alloc_request_;
   std::unique_ptr<MFXVideoENCODE> encoder_;
-  std::vector<uint8_t> bitstream_buffer_;
-  mfxBitstream bitstream_;
   mfxFrameInfo frame_info_;
+
+  // 同時にエンコードするフレームの数 (mfxVideoParam::AsyncDepth)
+  int async_depth_;
+  std::vector<std::unique_ptr<OutputSlot>> slots_;
+  std::mutex slot_mutex_;
+  std::condition_variable slot_cond_;
+  std::deque<OutputSlot*> free_slots_;
+  // エンコード中のフレーム。エンコードした順に並んでいる
+  std::deque<OutputSlot*> pending_slots_;
+  std::deque<FrameParams> frame_params_;
+  bool quit_ = false;
+  rtc::PlatformThread completion_thread_;
 };
 
 const int kLowH264QpThreshold = 34;
 const int kHighH264QpThreshold = 40;
 
 VplVideoEncoderImpl::VplVideoEncoderImpl(std::shared_ptr<VplSession> session,
-                                         mfxU32 codec)
-    : session_(session), codec_(codec), bitrate_adjuster_(0.5, 0.95) {}
+                                         mfxU32 codec,
+                                         int async_depth)
+    : session_(session),
+      codec_(codec),
+      bitrate_adjuster_(0.5, 0.95),
+      async_depth_(std::max(1, async_depth)) {}
 
 VplVideoEncoderImpl::~VplVideoEncoderImpl() {
   Release();
@@ -125,6 +173,7 @@ std::unique_ptr<MFXVideoENCODE> VplVideoEncoderImpl::CreateEncoder(
     int framerate,
     int target_kbps,
     int max_kbps,
+    int async_depth,
     bool init) {
   std::unique_ptr<MFXVideoENCODE> encoder(
       new MFXVideoENCODE(GetVplSession(session)));
@@ -140,7 +189,7 @@ std::unique_ptr<MFXVideoENCODE> VplVideoEncoderImpl::CreateEncoder(
   mfxVideoParam param;
   ExtBuffer ext;
   mfxStatus sts = Queries(encoder.get(), codec, width, height, framerate,
-                          target_kbps, max_kbps, param, ext);
+                          target_kbps, max_kbps, async_depth, param, ext);
   if (sts < MFX_ERR_NONE) {
     return nullptr;
   }
@@ -167,6 +216,7 @@ mfxStatus VplVideoEncoderImpl::Queries(MFXVideoENCODE* encoder,
                                        int framerate,
                                        int target_kbps,
                                        int max_kbps,
+                                       int async_depth,
                                        mfxVideoParam& param,
                                        ExtBuffer& ext) {
   mfxStatus sts = MFX_ERR_NONE;
@@ -211,7 +261,7 @@ mfxStatus VplVideoEncoderImpl::Queries(MFXVideoENCODE* encoder,
   param.mfx.FrameInfo.Height = (height + 15) / 16 * 16;
 
   param.mfx.GopRefDist = 1;
-  param.AsyncDepth = 1;
+  param.AsyncDepth = async_depth;
   param.IOPattern =
       MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
 
@@ -425,12 +475,19 @@ int32_t VplVideoEncoderImpl::Encode(
         (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
   }
 
+  // 出力先を確保する。async_depth_ 個のフレームがエンコード中の場合はここで待つ
+  OutputSlot* slot = AcquireSlot();
+  if (slot == nullptr) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
   // 使ってない入力サーフェスを取り出す
   auto surface =
       std::find_if(surfaces_.begin(), surfaces_.end(),
                    [](const mfxFrameSurface1& s) { return !s.Data.Locked; });
   if (surface == surfaces_.end()) {
     RTC_LOG(LS_ERROR) << "Surface not found";
+    ReleaseSlot(slot);
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
 
@@ -442,6 +499,9 @@ int32_t VplVideoEncoderImpl::Encode(
       frame_buffer->StrideU(), frame_buffer->DataV(), frame_buffer->StrideV(),
       surface->Data.Y, surface->Data.Pitch, surface->Data.U,
       surface->Data.Pitch, frame_buffer->width(), frame_buffer->height());
+  // エンコード結果の TimeStamp にそのまま入ってくるので、結果とフレームの対応付けに使う。
+  // VPL のタイムスタンプは RTP と同じ 90kHz
+  surface->Data.TimeStamp = frame.timestamp();
 
   mfxStatus sts;
 
@@ -469,11 +529,12 @@ int32_t VplVideoEncoderImpl::Encode(
     // ビットレートとフレームレートを変更する。
     // なお、encoder_->Reset() はキューイングしているサーフェスを
     // 全て処理してから呼び出す必要がある。
-    // ここでは encoder_->Init() の時に
+    // encoder_->Init() の時に
     //   param.mfx.GopRefDist = 1;
-    //   param.AsyncDepth = 1;
     //   ext_coding_option.MaxDecFrameBuffering = 1;
-    // を設定して、そもそもキューイングが起きないようにすることで対処している。
+    // を設定してエンコーダ内部でのキューイングが起きないようにした上で、
+    // 同時にエンコードしているフレームの完了を待ってから Reset する。
+    WaitForPendingFrames();
     if (param.mfx.RateControlMethod == MFX_RATECONTROL_CQP) {
       //param.mfx.QPI = h264_bitstream_parser_.GetLastSliceQp().value_or(30);
     } else {
@@ -495,25 +556,79 @@ int32_t VplVideoEncoderImpl::Encode(
                      << " ms";
   }
 
+  {
+    std::lock_guard<std::mutex> lock(slot_mutex_);
+    frame_params_.push_back(FrameParams{frame.timestamp(), frame.ntp_time_ms(),
+                                        frame.render_time_ms(),
+                                        frame.rotation(), frame.color_space()});
+  }
+
   // NV12 をハードウェアエンコード
-  mfxSyncPoint syncp;
-  sts = encoder_->EncodeFrameAsync(&ctrl, &*surface, &bitstream_, &syncp);
+  while (true) {
+    sts = encoder_->EncodeFrameAsync(&ctrl, &*surface, &slot->bitstream,
+                                     &slot->syncp);
+    if (sts == MFX_WRN_DEVICE_BUSY) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    break;
+  }
   // alloc_request_.NumFrameSuggested が 1 の場合は MFX_ERR_MORE_DATA は発生しない
   if (sts == MFX_ERR_MORE_DATA) {
     // もっと入力が必要なので出直す
+    ReleaseSlot(slot);
     return WEBRTC_VIDEO_CODEC_OK;
   }
+  if (sts < MFX_ERR_NONE) {
+    ReleaseSlot(slot);
+  }
   VPL_CHECK_RESULT(sts, MFX_ERR_NONE, sts);
 
-  sts = MFXVideoCORE_SyncOperation(GetVplSession(session_), syncp, 600000);
+  if (async_depth_ > 1) {
+    // 完了は別のスレッドで待つので、すぐに次のフレームを受け付ける
+    {
+      std::lock_guard<std::mutex> lock(slot_mutex_);
+      pending_slots_.push_back(slot);
+    }
+    slot_cond_.notify_all();
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  sts = MFXVideoCORE_SyncOperation(GetVplSession(session_), slot->syncp, 600000);
+  if (sts < MFX_ERR_NONE) {
+    ReleaseSlot(slot);
+  }
   VPL_CHECK_RESULT(sts, MFX_ERR_NONE, sts);
 
-  //RTC_LOG(LS_ERROR) << "SurfaceSize=" << (surface->Data.U - surface->Data.Y);
-  //RTC_LOG(LS_ERROR) << "DataLength=" << bitstream_.DataLength;
+  int32_t result = DeliverEncodedImage(slot);
+  ReleaseSlot(slot);
+  return result;
+}
+
+int32_t VplVideoEncoderImpl::DeliverEncodedImage(OutputSlot* slot) {
+  mfxBitstream& bitstream = slot->bitstream;
+
+  // エンコード結果に対応するフレームの情報を取り出す
+  FrameParams params = {};
+  params.rtp_timestamp = static_cast<uint32_t>(bitstream.TimeStamp);
   {
-    uint8_t* p = bitstream_.Data + bitstream_.DataOffset;
-    int size = bitstream_.DataLength;
-    bitstream_.DataLength = 0;
+    std::lock_guard<std::mutex> lock(slot_mutex_);
+    while (!frame_params_.empty()) {
+      FrameParams front = frame_params_.front();
+      frame_params_.pop_front();
+      if (front.rtp_timestamp == params.rtp_timestamp) {
+        params = front;
+        break;
+      }
+    }
+  }
+
+  //RTC_LOG(LS_ERROR) << "DataLength=" << bitstream.DataLength;
+  {
+    uint8_t* p = bitstream.Data + bitstream.DataOffset;
+    int size = bitstream.DataLength;
+    bitstream.DataLength = 0;
+    bitstream.DataOffset = 0;
 
     //FILE* fp = fopen("test.mp4", "a+");
     //fwrite(p, 1, size, fp);
@@ -536,13 +651,13 @@ int32_t VplVideoEncoderImpl::Encode(
             ? webrtc::VideoContentType::SCREENSHARE
             : webrtc::VideoContentType::UNSPECIFIED;
     encoded_image_.timing_.flags = webrtc::VideoSendTiming::kInvalid;
-    encoded_image_.SetRtpTimestamp(frame.timestamp());
-    encoded_image_.ntp_time_ms_ = frame.ntp_time_ms();
-    encoded_image_.capture_time_ms_ = frame.render_time_ms();
-    encoded_image_.rotation_ = frame.rotation();
-    encoded_image_.SetColorSpace(frame.color_space());
-    if (bitstream_.FrameType & MFX_FRAMETYPE_I ||
-        bitstream_.FrameType & MFX_FRAMETYPE_IDR) {
+    encoded_image_.SetRtpTimestamp(params.rtp_timestamp);
+    encoded_image_.ntp_time_ms_ = params.ntp_time_ms;
+    encoded_image_.capture_time_ms_ = params.render_time_ms;
+    encoded_image_.rotation_ = params.rotation;
+    encoded_image_.SetColorSpace(params.color_space);
+    if (bitstream.FrameType & MFX_FRAMETYPE_I ||
+        bitstream.FrameType & MFX_FRAMETYPE_IDR) {
       encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameKey;
     } else {
       encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameDelta;
@@ -591,8 +706,16 @@ int32_t VplVideoEncoderImpl::Encode(
       encoded_image_.qp_ = h265_bitstream_parser_.GetLastSliceQp().value_or(-1);
     }
 
+    webrtc::EncodedImageCallback* callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      callback = callback_;
+    }
+    if (callback == nullptr) {
+      return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+    }
     webrtc::EncodedImageCallback::Result result =
-        callback_->OnEncodedImage(encoded_image_, &codec_specific);
+        callback->OnEncodedImage(encoded_image_, &codec_specific);
     if (result.error != webrtc::EncodedImageCallback::Result::OK) {
       RTC_LOG(LS_ERROR) << __FUNCTION__
                         << " OnEncodedImage failed error:" << result.error;
@@ -603,6 +726,64 @@ int32_t VplVideoEncoderImpl::Encode(
 
   return WEBRTC_VIDEO_CODEC_OK;
 }
+
+VplVideoEncoderImpl::OutputSlot* VplVideoEncoderImpl::AcquireSlot() {
+  std::unique_lock<std::mutex> lock(slot_mutex_);
+  slot_cond_.wait(lock, [this] { return !free_slots_.empty() || quit_; });
+  if (free_slots_.empty()) {
+    return nullptr;
+  }
+  OutputSlot* slot = free_slots_.front();
+  free_slots_.pop_front();
+  return slot;
+}
+
+void VplVideoEncoderImpl::ReleaseSlot(OutputSlot* slot) {
+  {
+    std::lock_guard<std::mutex> lock(slot_mutex_);
+    free_slots_.push_back(slot);
+  }
+  slot_cond_.notify_all();
+}
+
+void VplVideoEncoderImpl::WaitForPendingFrames() {
+  std::unique_lock<std::mutex> lock(slot_mutex_);
+  slot_cond_.wait(lock, [this] { return pending_slots_.empty(); });
+}
+
+void VplVideoEncoderImpl::CompletionThread() {
+  while (true) {
+    OutputSlot* slot;
+    {
+      std::unique_lock<std::mutex> lock(slot_mutex_);
+      slot_cond_.wait(lock,
+                      [this] { return !pending_slots_.empty() || quit_; });
+      if (pending_slots_.empty()) {
+        break;
+      }
+      // 完了するまでは pending_slots_ に残しておく
+      slot = pending_slots_.front();
+    }
+
+    mfxStatus sts =
+        MFXVideoCORE_SyncOperation(GetVplSession(session_), slot->syncp, 600000);
+    if (sts != MFX_ERR_NONE) {
+      RTC_LOG(LS_ERROR) << "Failed to SyncOperation: sts=" << sts;
+      slot->bitstream.DataLength = 0;
+      slot->bitstream.DataOffset = 0;
+    } else {
+      DeliverEncodedImage(slot);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(slot_mutex_);
+      pending_slots_.pop_front();
+      free_slots_.push_back(slot);
+    }
+    slot_cond_.notify_all();
+  }
+}
+
 void VplVideoEncoderImpl::SetRates(const RateControlParameters& parameters) {
   if (parameters.framerate_fps < 1.0) {
     RTC_LOG(LS_WARNING) << "Invalid frame rate: " << parameters.framerate_fps;
@@ -634,7 +815,7 @@ webrtc::VideoEncoder::EncoderInfo VplVideoEncoderImpl::GetEncoderInfo() const {
 int32_t VplVideoEncoderImpl::InitVpl() {
   encoder_ = CreateEncoder(session_, codec_, width_, height_, framerate_,
                            bitrate_adjuster_.GetAdjustedBitrateBps() / 1000,
-                           max_bitrate_bps_ / 1000, true);
+                           max_bitrate_bps_ / 1000, async_depth_, true);
   if (encoder_ == nullptr) {
     RTC_LOG(LS_ERROR) << "Failed to create encoder";
     return WEBRTC_VIDEO_CODEC_ERROR;
@@ -649,7 +830,8 @@ int32_t VplVideoEncoderImpl::InitVpl() {
   // - BufferSizeInKB parameter is required to set bit stream buffer size
   sts = encoder_->GetVideoParam(&param);
   VPL_CHECK_RESULT(sts, MFX_ERR_NONE, sts);
-  RTC_LOG(LS_INFO) << "BufferSizeInKB=" << param.mfx.BufferSizeInKB;
+  RTC_LOG(LS_INFO) << "BufferSizeInKB=" << param.mfx.BufferSizeInKB
+                   << " AsyncDepth=" << param.AsyncDepth;
 
   // Query number of required surfaces for encoder
   memset(&alloc_request_, 0, sizeof(alloc_request_));
@@ -661,12 +843,24 @@ int32_t VplVideoEncoderImpl::InitVpl() {
 
   frame_info_ = param.mfx.FrameInfo;
 
-  // 出力ビットストリームの初期化
-  bitstream_buffer_.resize(param.mfx.BufferSizeInKB * 1000);
-
-  memset(&bitstream_, 0, sizeof(bitstream_));
-  bitstream_.MaxLength = bitstream_buffer_.size();
-  bitstream_.Data = bitstream_buffer_.data();
+  // 出力ビットストリームの初期化。同時にエンコードするフレームの数だけ作る
+  {
+    std::lock_guard<std::mutex> lock(slot_mutex_);
+    slots_.clear();
+    free_slots_.clear();
+    pending_slots_.clear();
+    frame_params_.clear();
+    quit_ = false;
+    for (int i = 0; i < async_depth_; i++) {
+      std::unique_ptr<OutputSlot> slot(new OutputSlot());
+      slot->buffer.resize(param.mfx.BufferSizeInKB * 1000);
+      memset(&slot->bitstream, 0, sizeof(slot->bitstream));
+      slot->bitstream.MaxLength = slot->buffer.size();
+      slot->bitstream.Data = slot->buffer.data();
+      free_slots_.push_back(slot.get());
+      slots_.push_back(std::move(slot));
+    }
+  }
 
   // 必要な枚数分の入力サーフェスを作る
   {
@@ -691,9 +885,25 @@ int32_t VplVideoEncoderImpl::InitVpl() {
     }
   }
 
+  if (async_depth_ > 1) {
+    completion_thread_ = rtc::PlatformThread::SpawnJoinable(
+        [this]() { CompletionThread(); }, "VplEncodeCompletion",
+        rtc::ThreadAttributes().SetPriority(rtc::ThreadPriority::kHigh));
+  }
+
   return WEBRTC_VIDEO_CODEC_OK;
 }
 int32_t VplVideoEncoderImpl::ReleaseVpl() {
+  if (!completion_thread_.empty()) {
+    // エンコード中のフレームを全て渡してからスレッドを止める
+    WaitForPendingFrames();
+    {
+      std::lock_guard<std::mutex> lock(slot_mutex_);
+      quit_ = true;
+    }
+    slot_cond_.notify_all();
+    completion_thread_.Finalize();
+  }
   if (encoder_ != nullptr) {
     encoder_->Close();
   }
@@ -712,7 +922,7 @@ bool VplVideoEncoder::IsSupported(std::shared_ptr<VplSession> session,
   }
 
   auto encoder = VplVideoEncoderImpl::CreateEncoder(
-      session, ToMfxCodec(codec), 1920, 1080, 30, 10, 20, false);
+      session, ToMfxCodec(codec), 1920, 1080, 30, 10, 20, 1, false);
   bool result = encoder != nullptr;
   RTC_LOG(LS_VERBOSE) << "IsSupported: codec="
                       << CodecToString(ToMfxCodec(codec))
@@ -722,9 +932,10 @@ bool VplVideoEncoder::IsSupported(std::shared_ptr<VplSession> session,
 
 std::unique_ptr<VplVideoEncoder> VplVideoEncoder::Create(
     std::shared_ptr<VplSession> session,
-    webrtc::VideoCodecType codec) {
+    webrtc::VideoCodecType codec,
+    int async_depth) {
   return std::unique_ptr<VplVideoEncoder>(
-      new VplVideoEncoderImpl(session, ToMfxCodec(codec)));
+      new VplVideoEncoderImpl(session, ToMfxCodec(codec), async_depth));
 }
 
 }  // namespace sora
@@ -78,13 +78,18 @@ class OpenH264VideoEncoder : public VideoEncoder {
     bool frame_dropping_on = false;
     int key_frame_interval = 0;
     int num_temporal_layers = 1;
+    // このレイヤーのエンコードに使うスレッド数
+    int num_threads = 1;
 
     void SetStreamState(bool send_stream);
   };
 
+  // max_threads はエンコードに使う最大のスレッド数で、全てのサイマルキャストのレイヤーで分け合う。
+  // 0 の場合は CPU のコア数を上限にする。
   OpenH264VideoEncoder(const Environment& env,
                        H264EncoderSettings settings,
-                       std::string openh264);
+                       std::string openh264,
+                       int max_threads);
 
   ~OpenH264VideoEncoder() override;
 
@@ -138,6 +143,7 @@ class OpenH264VideoEncoder : public VideoEncoder {
   size_t max_payload_size_;
   int32_t number_of_cores_;
   absl::optional<int> encoder_thread_limit_;
+  int max_threads_;
   EncodedImageCallback* encoded_image_callback_;
 
   bool has_reported_init_;
@@ -190,6 +196,8 @@ int NumberOfThreads(absl::optional<int> encoder_thread_limit,
   // bugs.webrtc.org/14368) so still guarded by field trial to allow for
   // experimentation using th experimental
   // WebRTC-VideoEncoderSettings/encoder_thread_limit trial.
+  // max_threads に 1 以外が指定された場合も、レイヤー毎に割り当てたスレッド数を
+  // encoder_thread_limit として渡して有効にする。
   if (encoder_thread_limit.has_value()) {
     int limit = encoder_thread_limit.value();
     RTC_DCHECK_GE(limit, 1);
@@ -208,6 +216,33 @@ int NumberOfThreads(absl::optional<int> encoder_thread_limit,
   return 1;
 }
 
+// 全体のスレッド数 total_threads を、各レイヤーの画素数に応じて分ける。
+// 各レイヤーには最低 1 スレッドを割り当てる。
+std::vector<int> DistributeThreads(const std::vector<int>& pixels,
+                                   int total_threads) {
+  std::vector<int> threads(pixels.size(), 1);
+  int64_t total_pixels = 0;
+  for (int p : pixels) {
+    total_pixels += p;
+  }
+  int remaining = total_threads - static_cast<int>(pixels.size());
+  if (remaining <= 0 || total_pixels == 0) {
+    return threads;
+  }
+  int assigned = 0;
+  for (size_t i = 0; i < pixels.size(); i++) {
+    int n = static_cast<int>(remaining * pixels[i] / total_pixels);
+    threads[i] += n;
+    assigned += n;
+  }
+  // 端数は大きいレイヤーから順に割り当てる (pixels は大きい順に並んでいる)
+  for (size_t i = 0; assigned < remaining; i = (i + 1) % threads.size()) {
+    threads[i]++;
+    assigned++;
+  }
+  return threads;
+}
+
 VideoFrameType ConvertToVideoFrameType(EVideoFrameType type) {
   switch (type) {
     case videoFrameTypeIDR:
@@ -296,11 +331,13 @@ static void RtpFragmentize(EncodedImage* encoded_image, SFrameBSInfo* info) {
 
 OpenH264VideoEncoder::OpenH264VideoEncoder(const Environment& env,
                                            H264EncoderSettings settings,
-                                           std::string openh264)
+                                           std::string openh264,
+                                           int max_threads)
     : env_(env),
       packetization_mode_(settings.packetization_mode),
       max_payload_size_(0),
       number_of_cores_(0),
+      max_threads_(max_threads),
       encoded_image_callback_(nullptr),
       has_reported_init_(false),
       has_reported_error_(false),
@@ -428,6 +465,22 @@ int32_t OpenH264VideoEncoder::InitEncode(
     codec_.simulcastStream[0].height = codec_.height;
   }
 
+  // サイマルキャストの各レイヤーはそれぞれ別のエンコーダで同時にエンコードするので、
+  // 全体のスレッド数がコア数を超えないように分け合う
+  std::vector<int> threads(number_of_streams, 1);
+  if (max_threads_ != 1) {
+    int total_threads = max_threads_ == 0
+                            ? number_of_cores_
+                            : std::min(max_threads_, number_of_cores_);
+    std::vector<int> pixels;
+    for (int i = 0, idx = number_of_streams - 1; i < number_of_streams;
+         ++i, --idx) {
+      pixels.push_back(codec_.simulcastStream[idx].width *
+                       codec_.simulcastStream[idx].height);
+    }
+    threads = DistributeThreads(pixels, total_threads);
+  }
+
   for (int i = 0, idx = number_of_streams - 1; i < number_of_streams;
        ++i, --idx) {
     ISVCEncoder* openh264_encoder;
@@ -473,6 +526,7 @@ int32_t OpenH264VideoEncoder::InitEncode(
     // Codec_settings uses kbits/second; encoder uses bits/second.
     configurations_[i].max_bps = codec_.maxBitrate * 1000;
     configurations_[i].target_bps = codec_.startBitrate * 1000;
+    configurations_[i].num_threads = threads[i];
 
     // Create encoder parameters based on the layer configuration.
     SEncParamExt encoder_params = CreateEncoderParams(i);
@@ -830,8 +884,12 @@ SEncParamExt OpenH264VideoEncoder::CreateEncoderParams(size_t i) const {
   //  0: auto (dynamic imp. internal encoder)
   //  1: single thread (default value)
   // >1: number of threads
+  absl::optional<int> thread_limit = encoder_thread_limit_;
+  if (!thread_limit && max_threads_ != 1) {
+    thread_limit = configurations_[i].num_threads;
+  }
   encoder_params.iMultipleThreadIdc =
-      NumberOfThreads(encoder_thread_limit_, encoder_params.iPicWidth,
+      NumberOfThreads(thread_limit, encoder_params.iPicWidth,
                       encoder_params.iPicHeight, number_of_cores_);
   // The base spatial layer 0 is the only one we use.
   encoder_params.sSpatialLayers[0].iVideoWidth = encoder_params.iPicWidth;
@@ -869,7 +927,10 @@ SEncParamExt OpenH264VideoEncoder::CreateEncoderParams(size_t i) const {
       // design it with cpu core number.
       // TODO(sprang): Set to 0 when we understand why the rate controller borks
       //               when uiSliceNum > 1.
-      encoder_params.sSpatialLayers[0].sSliceArgument.uiSliceNum = 1;
+      // マルチスレッドでエンコードする場合は、スライス単位で並列化されるので
+      // スレッド数と同じ数のスライスに分ける。
+      encoder_params.sSpatialLayers[0].sSliceArgument.uiSliceNum =
+          encoder_params.iMultipleThreadIdc;
       encoder_params.sSpatialLayers[0].sSliceArgument.uiSliceMode =
           SM_FIXEDSLCNUM_SLICE;
       break;
@@ -919,7 +980,8 @@ namespace sora {
 
 std::unique_ptr<webrtc::VideoEncoder> CreateOpenH264VideoEncoder(
     const webrtc::SdpVideoFormat& format,
-    std::string openh264) {
+    std::string openh264,
+    int max_threads) {
   webrtc::H264EncoderSettings settings;
   if (auto it = format.parameters.find(cricket::kH264FmtpPacketizationMode);
       it != format.parameters.end()) {
@@ -933,7 +995,7 @@ std::unique_ptr<webrtc::VideoEncoder> CreateOpenH264VideoEncoder(
   }
 
   return absl::make_unique<webrtc::OpenH264VideoEncoder>(
-      webrtc::CreateEnvironment(), settings, std::move(openh264));
+      webrtc::CreateEnvironment(), settings, std::move(openh264), max_threads);
 }
 
 }  // namespace sora
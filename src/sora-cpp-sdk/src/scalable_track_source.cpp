@@ -11,13 +11,16 @@
 #include "sora/scalable_track_source.h"
 
 #include <algorithm>
+#include <limits>
 
 // WebRTC
 #include <api/scoped_refptr.h>
+#include <api/units/timestamp.h>
 #include <api/video/i420_buffer.h>
 #include <api/video/video_frame_buffer.h>
 #include <api/video/video_rotation.h>
 #include <rtc_base/logging.h>
+#include <rtc_base/time_utils.h>
 
 // libyuv
 #include <libyuv.h>
@@ -26,7 +29,10 @@ namespace sora {
 
 ScalableVideoTrackSource::ScalableVideoTrackSource(
     ScalableVideoTrackSourceConfig config)
-    : AdaptedVideoTrackSource(4), config_(config) {}
+    : AdaptedVideoTrackSource(4),
+      config_(config),
+      scaled_buffer_cache_(std::make_shared<ScaledBufferCache>()),
+      max_framerate_fps_(std::numeric_limits<int>::max()) {}
 ScalableVideoTrackSource::~ScalableVideoTrackSource() {}
 
 bool ScalableVideoTrackSource::is_screencast() const {
@@ -46,51 +52,89 @@ bool ScalableVideoTrackSource::remote() const {
   return false;
 }
 
+void ScalableVideoTrackSource::AddOrUpdateSink(
+    rtc::VideoSinkInterface<webrtc::VideoFrame>* sink,
+    const rtc::VideoSinkWants& wants) {
+  AdaptedVideoTrackSource::AddOrUpdateSink(sink, wants);
+  // AdaptedVideoTrackSource の wants() は private なので、
+  // キャプチャ側で使うためにフレームレートの要求だけ自前で集計しておく
+  webrtc::MutexLock lock(&sinks_mutex_);
+  sink_max_framerates_[sink] = wants.max_framerate_fps;
+  UpdateMaxFramerate();
+}
+
+void ScalableVideoTrackSource::RemoveSink(
+    rtc::VideoSinkInterface<webrtc::VideoFrame>* sink) {
+  AdaptedVideoTrackSource::RemoveSink(sink);
+  webrtc::MutexLock lock(&sinks_mutex_);
+  sink_max_framerates_.erase(sink);
+  UpdateMaxFramerate();
+}
+
+void ScalableVideoTrackSource::UpdateMaxFramerate() {
+  int max_framerate_fps = std::numeric_limits<int>::max();
+  for (const auto& p : sink_max_framerates_) {
+    max_framerate_fps = std::min(max_framerate_fps, p.second);
+  }
+  max_framerate_fps_ = max_framerate_fps;
+}
+
+int ScalableVideoTrackSource::max_framerate_fps() const {
+  return max_framerate_fps_.load();
+}
+
+int64_t ScalableVideoTrackSource::ToCaptureTimestampUs(
+    int64_t capture_time_us) {
+  const int64_t now_us = rtc::TimeMicros();
+  int64_t timestamp_us;
+  if (capture_time_us >= 0) {
+    capture_delay_us_ = now_us - capture_time_us;
+    timestamp_us = capture_time_us;
+  } else if (capture_delay_us_ >= 0) {
+    timestamp_us = now_us - capture_delay_us_;
+  } else {
+    // 一度もキャプチャ時刻が取れていないストリームは受け取った時刻を使い続ける
+    timestamp_us = now_us;
+  }
+  if (timestamp_us <= last_capture_timestamp_us_) {
+    timestamp_us = last_capture_timestamp_us_ + 1;
+  }
+  last_capture_timestamp_us_ = timestamp_us;
+  return timestamp_us;
+}
+
 bool ScalableVideoTrackSource::OnCapturedFrame(
     const webrtc::VideoFrame& video_frame) {
+  return OnCapturedFrameInternal(video_frame, true);
+}
+
+bool ScalableVideoTrackSource::OnCapturedFrameWithCaptureTime(
+    const webrtc::VideoFrame& video_frame) {
+  return OnCapturedFrameInternal(video_frame, false);
+}
+
+bool ScalableVideoTrackSource::OnCapturedFrameInternal(
+    const webrtc::VideoFrame& video_frame,
+    bool align_timestamp) {
   webrtc::VideoFrame frame = video_frame;
+  // 後段でこのソース内の処理時間を計測できるように、受け取った時刻を覚えておく
+  const webrtc::Timestamp received_time =
+      webrtc::Timestamp::Micros(rtc::TimeMicros());
 
   const int64_t timestamp_us = frame.timestamp_us();
   const int64_t translated_timestamp_us =
-      timestamp_aligner_.TranslateTimestamp(timestamp_us, rtc::TimeMicros());
-
-  // 回転が必要
-  if (frame.rotation() != webrtc::kVideoRotation_0) {
-    int width;
-    int height;
-    libyuv::RotationMode mode;
-    switch (frame.rotation()) {
-      case webrtc::kVideoRotation_180:
-        width = frame.width();
-        height = frame.height();
-        mode = libyuv::kRotate180;
-        break;
-      case webrtc::kVideoRotation_90:
-        width = frame.height();
-        height = frame.width();
-        mode = libyuv::kRotate90;
-        break;
-      case webrtc::kVideoRotation_270:
-      default:
-        width = frame.height();
-        height = frame.width();
-        mode = libyuv::kRotate270;
-        break;
-    }
-
-    rtc::scoped_refptr<webrtc::I420Buffer> rotated =
-        webrtc::I420Buffer::Create(width, height);
-    rtc::scoped_refptr<webrtc::I420BufferInterface> src =
-        frame.video_frame_buffer()->ToI420();
-    libyuv::I420Rotate(src->DataY(), src->StrideY(), src->DataU(),
-                       src->StrideU(), src->DataV(), src->StrideV(),
-                       rotated->MutableDataY(), rotated->StrideY(),
-                       rotated->MutableDataU(), rotated->StrideU(),
-                       rotated->MutableDataV(), rotated->StrideV(),
-                       frame.width(), frame.height(), mode);
-    frame.set_video_frame_buffer(rotated);
-    frame.set_rotation(webrtc::kVideoRotation_0);
-  }
+      align_timestamp
+          ? timestamp_aligner_.TranslateTimestamp(timestamp_us,
+                                                  rtc::TimeMicros())
+          : timestamp_us;
+
+  // RTP の video-orientation 拡張で回転を伝えられる場合は、ここでは回転せずにそのまま渡す
+  webrtc::VideoRotation rotation = frame.rotation();
+  bool rotate = rotation != webrtc::kVideoRotation_0 && apply_rotation();
+  bool swap_size = rotate && (rotation == webrtc::kVideoRotation_90 ||
+                              rotation == webrtc::kVideoRotation_270);
+  const int rotated_width = swap_size ? frame.height() : frame.width();
+  const int rotated_height = swap_size ? frame.width() : frame.height();
 
   int adapted_width;
   int adapted_height;
@@ -98,7 +142,7 @@ bool ScalableVideoTrackSource::OnCapturedFrame(
   int crop_height;
   int crop_x;
   int crop_y;
-  if (!AdaptFrame(frame.width(), frame.height(), timestamp_us, &adapted_width,
+  if (!AdaptFrame(rotated_width, rotated_height, timestamp_us, &adapted_width,
                   &adapted_height, &crop_width, &crop_height, &crop_x,
                   &crop_y)) {
     return false;
@@ -108,8 +152,10 @@ bool ScalableVideoTrackSource::OnCapturedFrame(
     config_.on_frame(frame);
   }
 
-  if (frame.video_frame_buffer()->type() ==
-      webrtc::VideoFrameBuffer::Type::kNative) {
+  if (!rotate && frame.video_frame_buffer()->type() ==
+                     webrtc::VideoFrameBuffer::Type::kNative) {
+    frame.set_processing_time(
+        {received_time, webrtc::Timestamp::Micros(rtc::TimeMicros())});
     OnFrame(frame);
     return true;
   }
@@ -117,20 +163,67 @@ bool ScalableVideoTrackSource::OnCapturedFrame(
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
       frame.video_frame_buffer();
 
-  if (adapted_width != frame.width() || adapted_height != frame.height()) {
+  if (rotate) {
+    // 先に回転前の向きのまま縮小してから回転する。
+    // 縮小後の小さいバッファを回転するので、回転してから縮小するより処理が軽い
+    libyuv::RotationMode mode;
+    switch (rotation) {
+      case webrtc::kVideoRotation_180:
+        mode = libyuv::kRotate180;
+        break;
+      case webrtc::kVideoRotation_90:
+        mode = libyuv::kRotate90;
+        break;
+      case webrtc::kVideoRotation_270:
+      default:
+        mode = libyuv::kRotate270;
+        break;
+    }
+    const int scaled_width = swap_size ? adapted_height : adapted_width;
+    const int scaled_height = swap_size ? adapted_width : adapted_height;
+    rtc::scoped_refptr<webrtc::I420BufferInterface> src = buffer->ToI420();
+    if (scaled_width != src->width() || scaled_height != src->height()) {
+      rtc::scoped_refptr<webrtc::I420Buffer> scaled =
+          scaled_buffer_cache_->CreateI420Buffer(scaled_width, scaled_height);
+      scaled->ScaleFrom(*src);
+      src = scaled;
+    }
+    rtc::scoped_refptr<webrtc::I420Buffer> rotated =
+        scaled_buffer_cache_->CreateI420Buffer(adapted_width, adapted_height);
+    libyuv::I420Rotate(src->DataY(), src->StrideY(), src->DataU(),
+                       src->StrideU(), src->DataV(), src->StrideV(),
+                       rotated->MutableDataY(), rotated->StrideY(),
+                       rotated->MutableDataU(), rotated->StrideU(),
+                       rotated->MutableDataV(), rotated->StrideV(),
+                       src->width(), src->height(), mode);
+    buffer = rotated;
+    rotation = webrtc::kVideoRotation_0;
+  } else if (adapted_width != frame.width() ||
+             adapted_height != frame.height()) {
     // Video adapter has requested a down-scale. Allocate a new buffer and
     // return scaled version.
     rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
-        webrtc::I420Buffer::Create(adapted_width, adapted_height);
+        scaled_buffer_cache_->CreateI420Buffer(adapted_width, adapted_height);
     i420_buffer->ScaleFrom(*buffer->ToI420());
     buffer = i420_buffer;
   }
 
-  OnFrame(webrtc::VideoFrame::Builder()
-              .set_video_frame_buffer(buffer)
-              .set_rotation(frame.rotation())
-              .set_timestamp_us(translated_timestamp_us)
-              .build());
+  // サイマルキャストでは各レイヤーのエンコーダが同じフレームを縮小するので、
+  // 解像度毎の縮小結果をフレーム内でキャッシュして、縮小は最初に要求された時に一度だけ行う
+  scaled_buffer_cache_->NextFrame();
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kI420) {
+    buffer = PyramidI420Buffer::Create(buffer->ToI420(), scaled_buffer_cache_);
+  }
+
+  webrtc::VideoFrame adapted_frame =
+      webrtc::VideoFrame::Builder()
+          .set_video_frame_buffer(buffer)
+          .set_rotation(rotation)
+          .set_timestamp_us(translated_timestamp_us)
+          .build();
+  adapted_frame.set_processing_time(
+      {received_time, webrtc::Timestamp::Micros(rtc::TimeMicros())});
+  OnFrame(adapted_frame);
 
   return true;
 }
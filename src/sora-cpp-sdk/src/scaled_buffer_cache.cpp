@@ -0,0 +1,112 @@
+#include "sora/scaled_buffer_cache.h"
+
+// WebRTC
+#include <rtc_base/ref_counted_object.h>
+
+namespace sora {
+
+rtc::scoped_refptr<webrtc::I420Buffer> ScaledBufferCache::CreateI420Buffer(
+    int width,
+    int height) {
+  webrtc::MutexLock lock(&mutex_);
+  // VideoFrameBufferPool は解像度が変わると中身を捨ててしまうので、解像度毎に持つ
+  Entry& entry = entries_[std::make_pair(width, height)];
+  entry.last_used_frame = frame_count_;
+  if (!entry.pool) {
+    entry.pool.reset(new webrtc::VideoFrameBufferPool(false, 8));
+  }
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      entry.pool->CreateI420Buffer(width, height);
+  if (!buffer) {
+    // プールを使い切った場合はその場で確保する
+    buffer = webrtc::I420Buffer::Create(width, height);
+  }
+  return buffer;
+}
+
+void ScaledBufferCache::NextFrame() {
+  webrtc::MutexLock lock(&mutex_);
+  frame_count_++;
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (frame_count_ - it->second.last_used_frame > kMaxIdleFrames) {
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+rtc::scoped_refptr<PyramidI420Buffer> PyramidI420Buffer::Create(
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+    std::shared_ptr<ScaledBufferCache> cache) {
+  return rtc::make_ref_counted<PyramidI420Buffer>(std::move(buffer),
+                                                  std::move(cache));
+}
+
+PyramidI420Buffer::PyramidI420Buffer(
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+    std::shared_ptr<ScaledBufferCache> cache)
+    : buffer_(std::move(buffer)), cache_(std::move(cache)) {}
+
+int PyramidI420Buffer::width() const {
+  return buffer_->width();
+}
+int PyramidI420Buffer::height() const {
+  return buffer_->height();
+}
+const uint8_t* PyramidI420Buffer::DataY() const {
+  return buffer_->DataY();
+}
+const uint8_t* PyramidI420Buffer::DataU() const {
+  return buffer_->DataU();
+}
+const uint8_t* PyramidI420Buffer::DataV() const {
+  return buffer_->DataV();
+}
+int PyramidI420Buffer::StrideY() const {
+  return buffer_->StrideY();
+}
+int PyramidI420Buffer::StrideU() const {
+  return buffer_->StrideU();
+}
+int PyramidI420Buffer::StrideV() const {
+  return buffer_->StrideV();
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> PyramidI420Buffer::CropAndScale(
+    int offset_x,
+    int offset_y,
+    int crop_width,
+    int crop_height,
+    int scaled_width,
+    int scaled_height) {
+  // 切り抜きを伴う場合や、拡大する場合はキャッシュしない
+  if (offset_x != 0 || offset_y != 0 || crop_width != width() ||
+      crop_height != height() || scaled_width >= width() ||
+      scaled_height >= height()) {
+    return buffer_->CropAndScale(offset_x, offset_y, crop_width, crop_height,
+                                 scaled_width, scaled_height);
+  }
+
+  webrtc::MutexLock lock(&mutex_);
+  return GetOrScale(scaled_width, scaled_height);
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface> PyramidI420Buffer::GetOrScale(
+    int width,
+    int height) {
+  for (const auto& level : levels_) {
+    if (level->width() == width && level->height() == height) {
+      return level;
+    }
+  }
+
+  // 縮小済みのバッファから更に縮小すると画質が落ちるので、常に元のバッファから縮小する
+  rtc::scoped_refptr<webrtc::I420Buffer> scaled =
+      cache_->CreateI420Buffer(width, height);
+  scaled->ScaleFrom(*buffer_);
+  levels_.push_back(scaled);
+  return scaled;
+}
+
+}  // namespace sora
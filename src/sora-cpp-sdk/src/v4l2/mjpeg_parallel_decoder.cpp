@@ -0,0 +1,354 @@
+#include "sora/v4l2/mjpeg_parallel_decoder.h"
+
+// C
+#include <string.h>
+
+// C++
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// WebRTC
+#include <rtc_base/logging.h>
+#include <third_party/libyuv/include/libyuv.h>
+
+namespace sora {
+
+namespace {
+
+uint16_t ReadU16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+struct JpegLayout {
+  // SOF セグメントのマーカー位置
+  size_t sof_offset = 0;
+  // SOS セグメントのマーカー位置
+  size_t sos_offset = 0;
+  // エントロピー符号化データの先頭
+  size_t entropy_offset = 0;
+  int width = 0;
+  int height = 0;
+  int mcu_width = 0;
+  int mcu_height = 0;
+  int restart_interval = 0;
+};
+
+// スライスに分けられる JPEG かどうかを調べる。
+// ベースラインで、YCbCr の 3 成分を 1 つのスキャンにインターリーブしていて、
+// 4:2:0 か 4:2:2 で、リスタートマーカーがある場合だけ true を返す。
+bool ParseJpeg(const uint8_t* data, size_t size, JpegLayout* layout) {
+  if (size < 4 || data[0] != 0xff || data[1] != 0xd8) {
+    return false;
+  }
+  bool has_sof = false;
+  size_t pos = 2;
+  while (pos + 4 <= size) {
+    if (data[pos] != 0xff) {
+      return false;
+    }
+    uint8_t marker = data[pos + 1];
+    if (marker == 0xff) {
+      // フィルバイト
+      pos++;
+      continue;
+    }
+    size_t length = ReadU16(data + pos + 2);
+    if (length < 2 || pos + 2 + length > size) {
+      return false;
+    }
+    const uint8_t* seg = data + pos + 4;
+    if (marker == 0xc0 || marker == 0xc1) {
+      // 成分数を読む前に、3 成分分のセグメントがあることを確認する
+      if (length < 8 + 3 * 3 || seg[5] != 3) {
+        return false;
+      }
+      layout->height = ReadU16(seg + 1);
+      layout->width = ReadU16(seg + 3);
+      int h = seg[7] >> 4;
+      int v = seg[7] & 0xf;
+      if (h != 2 || (v != 1 && v != 2) || seg[10] != 0x11 ||
+          seg[13] != 0x11) {
+        return false;
+      }
+      layout->mcu_width = 8 * h;
+      layout->mcu_height = 8 * v;
+      layout->sof_offset = pos;
+      has_sof = true;
+    } else if (marker >= 0xc2 && marker <= 0xcf && marker != 0xc4 &&
+               marker != 0xc8 && marker != 0xcc) {
+      // プログレッシブや算術符号には対応しない
+      return false;
+    } else if (marker == 0xdd) {
+      if (length != 4) {
+        return false;
+      }
+      layout->restart_interval = ReadU16(seg);
+    } else if (marker == 0xda) {
+      if (!has_sof || length < 3 || seg[0] != 3) {
+        return false;
+      }
+      layout->sos_offset = pos;
+      layout->entropy_offset = pos + 2 + length;
+      return layout->restart_interval > 0 && layout->width > 0 &&
+             layout->height > 0;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+// エントロピー符号化データ中の RST マーカーの位置を集めて、EOI の位置を返す。
+// 0xFF を探すのは memchr に任せる (glibc では SIMD で実装されている)。
+bool FindRestartMarkers(const uint8_t* data,
+                        size_t size,
+                        size_t offset,
+                        std::vector<size_t>* markers,
+                        size_t* eoi) {
+  markers->clear();
+  const uint8_t* p = data + offset;
+  const uint8_t* end = data + size;
+  while (p + 1 < end) {
+    p = static_cast<const uint8_t*>(memchr(p, 0xff, end - p - 1));
+    if (p == nullptr) {
+      break;
+    }
+    uint8_t marker = p[1];
+    if (marker >= 0xd0 && marker <= 0xd7) {
+      markers->push_back(p - data);
+      p += 2;
+    } else if (marker == 0xd9) {
+      *eoi = p - data;
+      return true;
+    } else if (marker == 0x00) {
+      // バイトスタッフィング
+      p += 2;
+    } else if (marker == 0xff) {
+      p += 1;
+    } else {
+      // DNL や 2 つ目のスキャンなどには対応しない
+      return false;
+    }
+  }
+  // EOI が無い場合は末尾までをデータとみなす
+  *eoi = size;
+  return true;
+}
+
+}  // namespace
+
+size_t FindMjpegEndOfImage(const uint8_t* data,
+                           size_t size,
+                           size_t search_size) {
+  if (size < 2) {
+    return size;
+  }
+  search_size = std::min(search_size, size);
+  // FFD9 の FF が [begin, last) の範囲にあるかを末尾から探す
+  const size_t begin = size - search_size;
+  size_t last = size - 1;
+#if defined(__SSE2__)
+  const __m128i ff = _mm_set1_epi8(static_cast<char>(0xff));
+  while (last - begin >= 16) {
+    const size_t block = last - 16;
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + block)), ff));
+    while (mask != 0) {
+      int i = 31 - __builtin_clz(mask);
+      if (data[block + i + 1] == 0xd9) {
+        return block + i + 2;
+      }
+      mask &= ~(1 << i);
+    }
+    last = block;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t ff = vdupq_n_u8(0xff);
+  while (last - begin >= 16) {
+    const size_t block = last - 16;
+    if (vmaxvq_u8(vceqq_u8(vld1q_u8(data + block), ff)) != 0) {
+      for (int i = 15; i >= 0; i--) {
+        if (data[block + i] == 0xff && data[block + i + 1] == 0xd9) {
+          return block + i + 2;
+        }
+      }
+    }
+    last = block;
+  }
+#endif
+  while (last > begin) {
+    last--;
+    if (data[last] == 0xff && data[last + 1] == 0xd9) {
+      return last + 2;
+    }
+  }
+  return size;
+}
+
+std::unique_ptr<MjpegParallelDecoder> MjpegParallelDecoder::Create(
+    int num_threads) {
+  if (num_threads < 2) {
+    return nullptr;
+  }
+  std::unique_ptr<MjpegParallelDecoder> decoder(new MjpegParallelDecoder());
+  decoder->num_threads_ = num_threads;
+  // 呼び出し元のスレッドでも 1 スライスをデコードするので、1 つ少なく作る
+  for (int i = 0; i < num_threads - 1; i++) {
+    decoder->threads_.push_back(rtc::PlatformThread::SpawnJoinable(
+        [d = decoder.get()]() { d->Run(); }, "MjpegDecoder",
+        rtc::ThreadAttributes().SetPriority(rtc::ThreadPriority::kHigh)));
+  }
+  return decoder;
+}
+
+MjpegParallelDecoder::~MjpegParallelDecoder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread.Finalize();
+  }
+}
+
+void MjpegParallelDecoder::Run() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return quit_ || !tasks_.empty(); });
+      if (quit_) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_--;
+    }
+    done_cond_.notify_all();
+  }
+}
+
+bool MjpegParallelDecoder::Decode(const uint8_t* data,
+                                  size_t size,
+                                  webrtc::I420Buffer* dst) {
+  JpegLayout layout;
+  if (!ParseJpeg(data, size, &layout) || layout.width != dst->width() ||
+      layout.height != dst->height()) {
+    return false;
+  }
+  size_t eoi;
+  if (!FindRestartMarkers(data, size, layout.entropy_offset,
+                          &restart_markers_, &eoi)) {
+    return false;
+  }
+
+  const int mcus_per_row =
+      (layout.width + layout.mcu_width - 1) / layout.mcu_width;
+  const int mcu_rows =
+      (layout.height + layout.mcu_height - 1) / layout.mcu_height;
+  const int interval = layout.restart_interval;
+  const int intervals = (mcus_per_row * mcu_rows + interval - 1) / interval;
+  if ((int)restart_markers_.size() + 1 != intervals) {
+    return false;
+  }
+
+  // リスタート区間の境界と MCU 行の先頭が一致する行の間隔
+  const int row_step = interval / std::gcd(interval, mcus_per_row);
+  const int units = (mcu_rows + row_step - 1) / row_step;
+  const int num_slices = std::min(num_threads_, units);
+  if (num_slices < 2) {
+    return false;
+  }
+
+  if ((int)slices_.size() < num_slices) {
+    slices_.resize(num_slices);
+  }
+  struct Slice {
+    int y;
+    int height;
+  };
+  std::vector<Slice> slice_rects(num_slices);
+  for (int s = 0; s < num_slices; s++) {
+    int start_row = std::min(units * s / num_slices * row_step, mcu_rows);
+    int end_row = std::min(units * (s + 1) / num_slices * row_step, mcu_rows);
+    int y = start_row * layout.mcu_height;
+    int height = std::min(end_row * layout.mcu_height, layout.height) - y;
+
+    // エントロピー符号化データの範囲
+    int start_interval = start_row * mcus_per_row / interval;
+    int end_interval =
+        end_row == mcu_rows ? intervals : end_row * mcus_per_row / interval;
+    size_t begin = start_interval == 0
+                       ? layout.entropy_offset
+                       : restart_markers_[start_interval - 1] + 2;
+    size_t end =
+        end_row == mcu_rows ? eoi : restart_markers_[end_interval - 1];
+
+    // SOI から SOS までのヘッダをコピーし、SOF の高さをスライスの高さに書き換える
+    std::vector<uint8_t>& jpeg = slices_[s];
+    jpeg.assign(data, data + layout.entropy_offset);
+    jpeg[layout.sof_offset + 5] = height >> 8;
+    jpeg[layout.sof_offset + 6] = height & 0xff;
+    size_t base = jpeg.size();
+    jpeg.insert(jpeg.end(), data + begin, data + end);
+    // RST マーカーの番号はスライス毎に 0 から振り直す
+    for (int i = start_interval; i < end_interval - 1; i++) {
+      jpeg[base + restart_markers_[i] - begin + 1] =
+          0xd0 + (i - start_interval) % 8;
+    }
+    jpeg.push_back(0xff);
+    jpeg.push_back(0xd9);
+
+    slice_rects[s] = {y, height};
+  }
+
+  std::atomic<bool> failed(false);
+  auto decode_slice = [this, dst, &slice_rects, &failed](int s) {
+    const std::vector<uint8_t>& jpeg = slices_[s];
+    const Slice& rect = slice_rects[s];
+    int uv_y = rect.y / 2;
+    if (libyuv::ConvertToI420(
+            jpeg.data(), jpeg.size(),
+            dst->MutableDataY() + rect.y * dst->StrideY(), dst->StrideY(),
+            dst->MutableDataU() + uv_y * dst->StrideU(), dst->StrideU(),
+            dst->MutableDataV() + uv_y * dst->StrideV(), dst->StrideV(), 0, 0,
+            dst->width(), rect.height, dst->width(), rect.height,
+            libyuv::kRotate0, libyuv::FOURCC_MJPG) != 0) {
+      // MJPEG のデコードに失敗した場合は負の値ではなく 1 が返る
+      failed = true;
+    }
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int s = 1; s < num_slices; s++) {
+      tasks_.push_back([decode_slice, s]() { decode_slice(s); });
+      pending_++;
+    }
+  }
+  cond_.notify_all();
+  decode_slice(0);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this]() { return pending_ == 0; });
+  }
+
+  if (failed) {
+    RTC_LOG(LS_WARNING) << "Failed to decode MJPEG slices";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace sora
@@ -16,8 +16,14 @@
 #include <time.h>
 
 // C++
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <new>
 #include <string>
+#include <vector>
 
 // Linux
 #include <errno.h>
@@ -31,17 +37,129 @@
 // WebRTC
 #include <api/scoped_refptr.h>
 #include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
+#include <common_video/include/video_frame_buffer.h>
 #include <media/base/video_common.h>
 #include <modules/video_capture/video_capture.h>
 #include <modules/video_capture/video_capture_factory.h>
 #include <rtc_base/logging.h>
 #include <rtc_base/ref_counted_object.h>
+#include <rtc_base/time_utils.h>
 #include <third_party/libyuv/include/libyuv.h>
 
 #define MJPEG_EOS_SEARCH_SIZE 4096
 
 namespace sora {
 
+struct V4L2VideoCapturer::ZeroCopyState {
+  explicit ZeroCopyState(int buffer_count)
+      : i420_pool(false, std::max(buffer_count, 1)) {}
+  ~ZeroCopyState() {
+    for (const auto& mapping : mappings) {
+      munmap(mapping.start, mapping.length);
+    }
+  }
+
+  // 参照が無くなったバッファをドライバのキューに戻す
+  void Requeue(v4l2_buffer buf) {
+    std::lock_guard<std::mutex> lock(mutex);
+    in_flight--;
+    if (in_flight == 0) {
+      released_cond.notify_all();
+    }
+    // キャプチャが止まっていたら何もしない
+    if (fd < 0) {
+      return;
+    }
+    if (ioctl(fd, VIDIOC_QBUF, &buf) == -1) {
+      RTC_LOG(LS_INFO) << __FUNCTION__ << " Failed to enqueue capture buffer";
+    }
+  }
+
+  // フレームが参照中のバッファが全て解放されるまで待つ。
+  // タイムアウトした場合は false を返す。
+  bool WaitForRelease(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return released_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                  [this]() { return in_flight == 0; });
+  }
+
+  // ToI420 の変換先をプールから取得する。エンコーダのスレッドから呼ばれる
+  rtc::scoped_refptr<webrtc::I420Buffer> CreateI420Buffer(int width,
+                                                          int height) {
+    std::lock_guard<std::mutex> lock(mutex);
+    rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+        i420_pool.CreateI420Buffer(width, height);
+    if (!buffer) {
+      // プールを使い切った場合はその場で確保する
+      buffer = webrtc::I420Buffer::Create(width, height);
+    }
+    return buffer;
+  }
+
+  // fd と i420_pool は mutex で保護する
+  std::mutex mutex;
+  std::condition_variable released_cond;
+  int fd = -1;
+  // フレームが参照中のバッファの数
+  std::atomic<int> in_flight{0};
+  webrtc::VideoFrameBufferPool i420_pool;
+  // キャプチャ停止時にフレームの解放が間に合わなかった場合に、
+  // 最後のフレームが解放された時に munmap する領域
+  std::vector<Buffer> mappings;
+};
+
+namespace {
+
+// V4L2 の NV12 バッファをコピーせずに参照するバッファ
+class V4L2MmapNV12Buffer : public webrtc::NV12BufferInterface {
+ public:
+  V4L2MmapNV12Buffer(
+      int width,
+      int height,
+      const uint8_t* data,
+      int stride,
+      std::function<rtc::scoped_refptr<webrtc::I420Buffer>(int, int)>
+          create_i420_buffer,
+      std::function<void()> on_destruction)
+      : width_(width),
+        height_(height),
+        data_(data),
+        stride_(stride),
+        create_i420_buffer_(std::move(create_i420_buffer)),
+        on_destruction_(std::move(on_destruction)) {}
+  ~V4L2MmapNV12Buffer() override { on_destruction_(); }
+
+  int width() const override { return width_; }
+  int height() const override { return height_; }
+  const uint8_t* DataY() const override { return data_; }
+  const uint8_t* DataUV() const override { return data_ + stride_ * height_; }
+  int StrideY() const override { return stride_; }
+  int StrideUV() const override { return stride_; }
+
+  rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override {
+    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+        create_i420_buffer_(width_, height_);
+    libyuv::NV12ToI420(DataY(), StrideY(), DataUV(), StrideUV(),
+                       i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+                       i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+                       i420_buffer->MutableDataV(), i420_buffer->StrideV(),
+                       width_, height_);
+    return i420_buffer;
+  }
+
+ private:
+  const int width_;
+  const int height_;
+  const uint8_t* data_;
+  const int stride_;
+  std::function<rtc::scoped_refptr<webrtc::I420Buffer>(int, int)>
+      create_i420_buffer_;
+  std::function<void()> on_destruction_;
+};
+
+}  // namespace
+
 rtc::scoped_refptr<V4L2VideoCapturer> V4L2VideoCapturer::Create(
     const V4L2VideoCapturerConfig& config) {
   rtc::scoped_refptr<V4L2VideoCapturer> capturer;
@@ -120,13 +238,21 @@ V4L2VideoCapturer::V4L2VideoCapturer(const V4L2VideoCapturerConfig& config)
     : ScalableVideoTrackSource(config),
       _deviceFd(-1),
       _buffersAllocatedByDevice(-1),
+      _bufferCount(std::max(config.buffer_count, 2)),
+      _bytesPerLine(0),
       _currentWidth(-1),
       _currentHeight(-1),
       _currentFrameRate(-1),
       _useNative(false),
+      _useZeroCopy(false),
       _captureStarted(false),
       _captureVideoType(webrtc::VideoType::kI420),
-      _pool(NULL) {}
+      _pool(NULL),
+      // エンコーダ等がフレームを保持している間も回せるように、
+      // V4L2 のバッファ数より多めに確保しておく
+      buffer_pool_(false, std::max(config.buffer_count, 2) * 2),
+      buffer_pool_hits_(0),
+      buffer_pool_misses_(0) {}
 
 bool V4L2VideoCapturer::FindDevice(const char* deviceUniqueIdUTF8,
                                    const std::string& device) {
@@ -199,7 +325,7 @@ int32_t V4L2VideoCapturer::StartCapture(const V4L2VideoCapturerConfig& config) {
   // Supported video formats in preferred order.
   // If the requested resolution is larger than VGA, we prefer MJPEG. Go for
   // I420 otherwise.
-  const int nFormats = 6;
+  const int nFormats = 7;
   unsigned int fmts[nFormats] = {};
   if (config.use_native) {
     fmts[0] = V4L2_PIX_FMT_MJPEG;
@@ -209,16 +335,18 @@ int32_t V4L2VideoCapturer::StartCapture(const V4L2VideoCapturerConfig& config) {
     fmts[0] = V4L2_PIX_FMT_MJPEG;
     fmts[1] = V4L2_PIX_FMT_YUV420;
     fmts[2] = V4L2_PIX_FMT_YVU420;
-    fmts[3] = V4L2_PIX_FMT_YUYV;
-    fmts[4] = V4L2_PIX_FMT_UYVY;
-    fmts[5] = V4L2_PIX_FMT_JPEG;
+    fmts[3] = V4L2_PIX_FMT_NV12;
+    fmts[4] = V4L2_PIX_FMT_YUYV;
+    fmts[5] = V4L2_PIX_FMT_UYVY;
+    fmts[6] = V4L2_PIX_FMT_JPEG;
   } else {
     fmts[0] = V4L2_PIX_FMT_YUV420;
     fmts[1] = V4L2_PIX_FMT_YVU420;
-    fmts[2] = V4L2_PIX_FMT_YUYV;
-    fmts[3] = V4L2_PIX_FMT_UYVY;
-    fmts[4] = V4L2_PIX_FMT_MJPEG;
-    fmts[5] = V4L2_PIX_FMT_JPEG;
+    fmts[2] = V4L2_PIX_FMT_NV12;
+    fmts[3] = V4L2_PIX_FMT_YUYV;
+    fmts[4] = V4L2_PIX_FMT_UYVY;
+    fmts[5] = V4L2_PIX_FMT_MJPEG;
+    fmts[6] = V4L2_PIX_FMT_JPEG;
   }
 
   // Enumerate image formats.
@@ -263,6 +391,8 @@ int32_t V4L2VideoCapturer::StartCapture(const V4L2VideoCapturerConfig& config) {
     _captureVideoType = webrtc::VideoType::kI420;
   else if (video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420)
     _captureVideoType = webrtc::VideoType::kYV12;
+  else if (video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_NV12)
+    _captureVideoType = webrtc::VideoType::kNV12;
   else if (video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_UYVY)
     _captureVideoType = webrtc::VideoType::kUYVY;
   else if (video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG ||
@@ -278,6 +408,7 @@ int32_t V4L2VideoCapturer::StartCapture(const V4L2VideoCapturerConfig& config) {
   // initialize current width and height
   _currentWidth = video_fmt.fmt.pix.width;
   _currentHeight = video_fmt.fmt.pix.height;
+  _bytesPerLine = video_fmt.fmt.pix.bytesperline;
 
   // Trying to set frame rate, before check driver capability.
   bool driver_framerate_support = true;
@@ -337,6 +468,18 @@ int32_t V4L2VideoCapturer::StartCapture(const V4L2VideoCapturerConfig& config) {
   }
 
   _useNative = config.use_native;
+  _useZeroCopy = config.zero_copy && !config.use_native &&
+                 (_captureVideoType == webrtc::VideoType::kI420 ||
+                  _captureVideoType == webrtc::VideoType::kYV12 ||
+                  _captureVideoType == webrtc::VideoType::kNV12);
+  if (config.zero_copy && !_useZeroCopy) {
+    RTC_LOG(LS_WARNING) << "Zero-copy capture is not available for format "
+                        << cricket::GetFourccName(fmts[fmtsIdx]);
+  }
+  if (_captureVideoType == webrtc::VideoType::kMJPEG && !config.use_native &&
+      config.mjpeg_decode_threads > 1 && !mjpeg_decoder_) {
+    mjpeg_decoder_ = MjpegParallelDecoder::Create(config.mjpeg_decode_threads);
+  }
   _captureStarted = true;
   return 0;
 }
@@ -357,6 +500,11 @@ int32_t V4L2VideoCapturer::StopCapture() {
     DeAllocateVideoBuffers();
     close(_deviceFd);
     _deviceFd = -1;
+
+    buffer_pool_.Release();
+    RTC_LOG(LS_INFO) << "V4L2VideoCapturer buffer pool: hits="
+                     << buffer_pool_hits_.load()
+                     << " misses=" << buffer_pool_misses_.load();
   }
 
   return 0;
@@ -370,15 +518,15 @@ bool V4L2VideoCapturer::AllocateVideoBuffers() {
 
   rbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   rbuffer.memory = V4L2_MEMORY_MMAP;
-  rbuffer.count = kNoOfV4L2Bufffers;
+  rbuffer.count = _bufferCount;
 
   if (ioctl(_deviceFd, VIDIOC_REQBUFS, &rbuffer) < 0) {
     RTC_LOG(LS_INFO) << "Could not get buffers from device. errno = " << errno;
     return false;
   }
 
-  if (rbuffer.count > kNoOfV4L2Bufffers)
-    rbuffer.count = kNoOfV4L2Bufffers;
+  if (rbuffer.count > _bufferCount)
+    rbuffer.count = _bufferCount;
 
   _buffersAllocatedByDevice = rbuffer.count;
 
@@ -411,13 +559,41 @@ bool V4L2VideoCapturer::AllocateVideoBuffers() {
       return false;
     }
   }
+
+  zero_copy_state_ = std::make_shared<ZeroCopyState>(rbuffer.count);
+  {
+    std::lock_guard<std::mutex> lock(zero_copy_state_->mutex);
+    zero_copy_state_->fd = _deviceFd;
+  }
   return true;
 }
 
 bool V4L2VideoCapturer::DeAllocateVideoBuffers() {
-  // unmap buffers
-  for (int i = 0; i < _buffersAllocatedByDevice; i++)
-    munmap(_pool[i].start, _pool[i].length);
+  if (zero_copy_state_) {
+    {
+      std::lock_guard<std::mutex> lock(zero_copy_state_->mutex);
+      // これ以降、解放されたバッファはキューに戻さない
+      zero_copy_state_->fd = -1;
+    }
+    // mmap した領域が残っていると次の VIDIOC_REQBUFS が EBUSY で失敗して
+    // キャプチャを再開できないので、エンコーダ等がフレームを解放するまで待つ
+    if (!zero_copy_state_->WaitForRelease(kZeroCopyReleaseTimeoutMs)) {
+      RTC_LOG(LS_WARNING) << "Timed out waiting for "
+                          << zero_copy_state_->in_flight
+                          << " zero-copy frames to be released";
+    }
+  }
+
+  if (zero_copy_state_ && zero_copy_state_->in_flight > 0) {
+    // まだフレームが参照しているので、munmap は最後のフレームが解放された時に行う
+    for (int i = 0; i < _buffersAllocatedByDevice; i++)
+      zero_copy_state_->mappings.push_back(_pool[i]);
+  } else {
+    // unmap buffers
+    for (int i = 0; i < _buffersAllocatedByDevice; i++)
+      munmap(_pool[i].start, _pool[i].length);
+  }
+  zero_copy_state_ = nullptr;
 
   delete[] _pool;
 
@@ -466,64 +642,165 @@ bool V4L2VideoCapturer::CaptureProcess() {
     }
 
     if (_captureStarted) {
-      struct v4l2_buffer buf;
-      memset(&buf, 0, sizeof(struct v4l2_buffer));
-      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory = V4L2_MEMORY_MMAP;
-      // dequeue a buffer - repeat until dequeued properly!
-      while (ioctl(_deviceFd, VIDIOC_DQBUF, &buf) < 0) {
-        if (errno != EINTR) {
-          RTC_LOG(LS_INFO) << "could not sync on a buffer on device "
-                           << strerror(errno);
-          return true;
-        }
-      }
+      ProcessCapturedBuffer();
+    }
+  }
+  usleep(0);
+  return true;
+}
 
-      uint8_t* data = (uint8_t*)_pool[buf.index].start;
-      uint32_t bytesused = buf.bytesused;
-      // 一部のカメラ (DELL WB7022) は不正なデータを送ってくることがある。
-      // これをハードウェアJPEGデコーダーに送ると Momo ごとクラッシュしてしまう。
-      // JPEG の先頭は SOI マーカー 0xffd8 で始まるのでチェックして落ちないようにする。
-      if (_captureVideoType == webrtc::VideoType::kMJPEG && bytesused >= 2) {
-        if (data[0] != 0xff || data[1] != 0xd8) {
-          RTC_LOG(LS_WARNING)
-              << __FUNCTION__ << " Invalid JPEG buffer frame skipped";
-        } else {
-          unsigned int eosSearchSize = MJPEG_EOS_SEARCH_SIZE;
-          uint8_t* p;
-          /* v4l2_buf.bytesused may have padding bytes for alignment
-              Search for EOF to get exact size */
-          if (eosSearchSize > bytesused)
-            eosSearchSize = bytesused;
-          for (unsigned int i = 0; i < eosSearchSize; i++) {
-            p = data + bytesused;
-            if ((*(p - 2) == 0xff) && (*(p - 1) == 0xd9)) {
-              break;
-            }
-            bytesused--;
-          }
-          OnCaptured(data, bytesused);
-        }
-      } else {
-        OnCaptured(data, bytesused);
-      }
+void V4L2VideoCapturer::ProcessCapturedBuffer() {
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(struct v4l2_buffer));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  // dequeue a buffer - repeat until dequeued properly!
+  while (ioctl(_deviceFd, VIDIOC_DQBUF, &buf) < 0) {
+    if (errno != EINTR) {
+      RTC_LOG(LS_INFO) << "could not sync on a buffer on device "
+                       << strerror(errno);
+      return;
+    }
+  }
 
-      // enqueue the buffer again
-      if (ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
-        RTC_LOG(LS_INFO) << __FUNCTION__ << " Failed to enqueue capture buffer";
-      }
+  uint8_t* data = (uint8_t*)_pool[buf.index].start;
+  uint32_t bytesused = buf.bytesused;
+  // 一部のカメラ (DELL WB7022) は不正なデータを送ってくることがある。
+  // これをハードウェアJPEGデコーダーに送ると Momo ごとクラッシュしてしまう。
+  // JPEG の先頭は SOI マーカー 0xffd8 で始まるのでチェックして落ちないようにする。
+  if (_captureVideoType == webrtc::VideoType::kMJPEG && bytesused >= 2) {
+    if (data[0] != 0xff || data[1] != 0xd8) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__
+                          << " Invalid JPEG buffer frame skipped";
+    } else {
+      /* v4l2_buf.bytesused may have padding bytes for alignment
+          Search for EOF to get exact size */
+      bytesused = FindMjpegEndOfImage(data, bytesused, MJPEG_EOS_SEARCH_SIZE);
+      OnCaptured(data, bytesused,
+                 ToCaptureTimestampUs(GetCaptureTimestampUs(buf)));
     }
+  } else if (_useZeroCopy && OnCapturedZeroCopy(buf)) {
+    // バッファはフレームが解放された時にキューに戻る
+    return;
+  } else {
+    OnCaptured(data, bytesused,
+               ToCaptureTimestampUs(GetCaptureTimestampUs(buf)));
   }
-  usleep(0);
+
+  // enqueue the buffer again
+  if (ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
+    RTC_LOG(LS_INFO) << __FUNCTION__ << " Failed to enqueue capture buffer";
+  }
+}
+
+bool V4L2VideoCapturer::OnCapturedZeroCopy(const v4l2_buffer& buf) {
+  // 全てのバッファをフレームが握ってしまうとキャプチャが止まるので、
+  // ドライバ側に最低限のバッファが残らない場合はコピーする
+  if (_buffersAllocatedByDevice - (zero_copy_state_->in_flight + 1) <
+      kMinQueuedV4L2Buffers) {
+    return false;
+  }
+
+  const int stride = _bytesPerLine > 0 ? _bytesPerLine : _currentWidth;
+  const int chroma_stride = stride / 2;
+  const int chroma_height = (_currentHeight + 1) / 2;
+  const size_t required_size =
+      _captureVideoType == webrtc::VideoType::kNV12
+          ? stride * _currentHeight + stride * chroma_height
+          : stride * _currentHeight + chroma_stride * chroma_height * 2;
+  if (buf.bytesused < required_size) {
+    return false;
+  }
+
+  const uint8_t* data = static_cast<const uint8_t*>(_pool[buf.index].start);
+  std::shared_ptr<ZeroCopyState> state = zero_copy_state_;
+  state->in_flight++;
+  std::function<void()> on_destruction = [state, buf]() {
+    state->Requeue(buf);
+  };
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer;
+  if (_captureVideoType == webrtc::VideoType::kNV12) {
+    frame_buffer = rtc::make_ref_counted<V4L2MmapNV12Buffer>(
+        _currentWidth, _currentHeight, data, stride,
+        [state](int width, int height) {
+          return state->CreateI420Buffer(width, height);
+        },
+        std::move(on_destruction));
+  } else {
+    const uint8_t* u = data + stride * _currentHeight;
+    const uint8_t* v = u + chroma_stride * chroma_height;
+    if (_captureVideoType == webrtc::VideoType::kYV12) {
+      std::swap(u, v);
+    }
+    frame_buffer = webrtc::WrapI420Buffer(_currentWidth, _currentHeight, data,
+                                          stride, u, chroma_stride, v,
+                                          chroma_stride,
+                                          std::move(on_destruction));
+  }
+
+  const int64_t timestamp_us = ToCaptureTimestampUs(GetCaptureTimestampUs(buf));
+  webrtc::VideoFrame video_frame =
+      webrtc::VideoFrame::Builder()
+          .set_video_frame_buffer(frame_buffer)
+          .set_timestamp_rtp(0)
+          .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+          .set_timestamp_us(timestamp_us)
+          .set_rotation(webrtc::kVideoRotation_0)
+          .build();
+  OnCapturedFrameWithCaptureTime(video_frame);
   return true;
 }
 
-void V4L2VideoCapturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
+V4L2VideoCapturer::BufferPoolStats V4L2VideoCapturer::GetBufferPoolStats()
+    const {
+  BufferPoolStats stats;
+  stats.hits = buffer_pool_hits_.load();
+  stats.misses = buffer_pool_misses_.load();
+  return stats;
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> V4L2VideoCapturer::CreateI420Buffer(
+    int width,
+    int height) {
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      buffer_pool_.CreateI420Buffer(width, height);
+  if (!buffer) {
+    // プールを使い切った場合はその場で確保する
+    buffer_pool_misses_++;
+    return webrtc::I420Buffer::Create(width, height);
+  }
+  buffer_pool_hits_++;
+  return buffer;
+}
+
+int64_t V4L2VideoCapturer::GetCaptureTimestampUs(const v4l2_buffer& buf) {
+  if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) !=
+      V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+    return -1;
+  }
+  const int64_t now_us = rtc::TimeMicros();
+  const int64_t timestamp_us =
+      static_cast<int64_t>(buf.timestamp.tv_sec) * rtc::kNumMicrosecsPerSec +
+      buf.timestamp.tv_usec;
+  // 未来の時刻や、1 秒以上前の時刻はドライバのタイムスタンプが壊れているとみなす
+  if (timestamp_us <= 0 || timestamp_us > now_us ||
+      now_us - timestamp_us > rtc::kNumMicrosecsPerSec) {
+    return -1;
+  }
+  return timestamp_us;
+}
+
+void V4L2VideoCapturer::OnCaptured(uint8_t* data,
+                                   uint32_t bytesused,
+                                   int64_t timestamp_us) {
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> dst_buffer = nullptr;
   rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
-      webrtc::I420Buffer::Create(_currentWidth, _currentHeight));
-  i420_buffer->InitializeData();
-  if (libyuv::ConvertToI420(
+      CreateI420Buffer(_currentWidth, _currentHeight));
+  if (mjpeg_decoder_ && _captureVideoType == webrtc::VideoType::kMJPEG &&
+      mjpeg_decoder_->Decode(data, bytesused, i420_buffer.get())) {
+    dst_buffer = i420_buffer;
+  } else if (libyuv::ConvertToI420(
           data, bytesused, i420_buffer.get()->MutableDataY(),
           i420_buffer.get()->StrideY(), i420_buffer.get()->MutableDataU(),
           i420_buffer.get()->StrideU(), i420_buffer.get()->MutableDataV(),
@@ -536,14 +813,15 @@ void V4L2VideoCapturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
   }
 
   if (dst_buffer) {
-    webrtc::VideoFrame video_frame = webrtc::VideoFrame::Builder()
-                                         .set_video_frame_buffer(dst_buffer)
-                                         .set_timestamp_rtp(0)
-                                         .set_timestamp_ms(rtc::TimeMillis())
-                                         .set_timestamp_us(rtc::TimeMicros())
-                                         .set_rotation(webrtc::kVideoRotation_0)
-                                         .build();
-    OnCapturedFrame(video_frame);
+    webrtc::VideoFrame video_frame =
+        webrtc::VideoFrame::Builder()
+            .set_video_frame_buffer(dst_buffer)
+            .set_timestamp_rtp(0)
+            .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+            .set_timestamp_us(timestamp_us)
+            .set_rotation(webrtc::kVideoRotation_0)
+            .build();
+    OnCapturedFrameWithCaptureTime(video_frame);
   }
 }
 
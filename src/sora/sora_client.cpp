@@ -287,6 +287,9 @@ void SoraClient::DoSendConnect(bool redirect) {
   if (config_.simulcast) {
     json_message["simulcast"] = true;
   }
+  if (config_.simulcast && !config_.simulcast_rid.empty()) {
+    json_message["simulcast_rid"] = config_.simulcast_rid;
+  }
 
   if (config_.spotlight) {
     json_message["spotlight"] = true;
@@ -294,6 +297,12 @@ void SoraClient::DoSendConnect(bool redirect) {
   if (config_.spotlight && config_.spotlight_number > 0) {
     json_message["spotlight_number"] = config_.spotlight_number;
   }
+  if (config_.spotlight && !config_.spotlight_focus_rid.empty()) {
+    json_message["spotlight_focus_rid"] = config_.spotlight_focus_rid;
+  }
+  if (config_.spotlight && !config_.spotlight_unfocus_rid.empty()) {
+    json_message["spotlight_unfocus_rid"] = config_.spotlight_unfocus_rid;
+  }
 
   if (!config_.metadata.is_null()) {
     json_message["metadata"] = config_.metadata;
@@ -604,7 +613,9 @@ void SoraClient::OnRead(boost::system::error_code ec,
       connection_->GetStats(
           [self = shared_from_this()](
               const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
-            self->DoSendPong(report);
+            // SendDataChannel は ioc のスレッドからしか呼ばないようにする
+            boost::asio::post(self->ioc_,
+                              [self, report]() { self->DoSendPong(report); });
           });
     } else {
       DoSendPong();
@@ -631,10 +642,18 @@ void SoraClient::OnRead(boost::system::error_code ec,
 webrtc::DataBuffer SoraClient::ConvertToDataBuffer(const std::string& label,
                                                    const std::string& input) {
   bool compressed = compressed_labels_.find(label) != compressed_labels_.end();
-  RTC_LOG(LS_INFO) << "Convert to DataBuffer: label=" << label
-                   << " compressed=" << compressed << " input=" << input;
-  const std::string& str = compressed ? ZlibHelper::Compress(input) : input;
-  return webrtc::DataBuffer(rtc::CopyOnWriteBuffer(str), compressed);
+  RTC_LOG(LS_VERBOSE) << "Convert to DataBuffer: label=" << label
+                      << " compressed=" << compressed
+                      << " size=" << input.size();
+  if (!compressed) {
+    return webrtc::DataBuffer(rtc::CopyOnWriteBuffer(input), false);
+  }
+  auto& deflater = deflaters_[label];
+  if (!deflater) {
+    deflater.reset(new ZlibDeflater());
+  }
+  const std::string& str = deflater->Compress(input);
+  return webrtc::DataBuffer(rtc::CopyOnWriteBuffer(str), true);
 }
 
 void SoraClient::SendDataChannel(const std::string& label,
@@ -655,15 +674,21 @@ void SoraClient::OnMessage(
 
   std::string label = data_channel->label();
   bool compressed = compressed_labels_.find(label) != compressed_labels_.end();
-  std::string data;
+  boost::json::string_view data;
   if (compressed) {
-    data = ZlibHelper::Uncompress(buffer.data.cdata(), buffer.size());
+    auto& inflater = inflaters_[label];
+    if (!inflater) {
+      inflater.reset(new ZlibInflater());
+    }
+    const std::string& str =
+        inflater->Uncompress(buffer.data.cdata(), buffer.size());
+    data = boost::json::string_view(str.data(), str.size());
   } else {
-    data.assign((const char*)buffer.data.cdata(),
-                (const char*)buffer.data.cdata() + buffer.size());
+    data = boost::json::string_view((const char*)buffer.data.cdata(),
+                                    buffer.size());
   }
 
-  RTC_LOG(LS_INFO) << "label=" << label << " data=" << data;
+  RTC_LOG(LS_VERBOSE) << "label=" << label << " data=" << std::string(data);
 
   // ハンドリングする必要のあるラベル以外は何もしない
   if (label != "signaling" && label != "stats") {
@@ -714,7 +739,9 @@ void SoraClient::OnMessage(
     connection_->GetStats(
         [self = shared_from_this()](
             const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
-          self->DoSendPong(report);
+          // SendDataChannel は ioc のスレッドからしか呼ばないようにする
+          boost::asio::post(self->ioc_,
+                            [self, report]() { self->DoSendPong(report); });
         });
   }
 }
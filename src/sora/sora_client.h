@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <functional>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -21,6 +22,7 @@
 #include "url_parts.h"
 #include "watchdog.h"
 #include "websocket.h"
+#include "zlib_helper.h"
 
 struct SoraClientConfig {
   std::vector<std::string>
@@ -38,6 +40,12 @@ struct SoraClientConfig {
   std::string role = "sendonly";
   bool spotlight = false;
   int spotlight_number = 0;
+  // 受信するサイマルキャストのレイヤー ("r0", "r1", "r2")。空文字の場合は Sora 側で決める
+  std::string simulcast_rid;
+  // スポットライトでフォーカスされている/されていない映像で受信するレイヤー
+  // ("none", "r0", "r1", "r2")。空文字の場合は Sora 側で決める
+  std::string spotlight_focus_rid;
+  std::string spotlight_unfocus_rid;
   int port = -1;
   bool simulcast = false;
   boost::optional<bool> data_channel_signaling;
@@ -142,6 +150,10 @@ class SoraClient : public std::enable_shared_from_this<SoraClient>,
   std::shared_ptr<SoraDataChannelOnAsio> dc_;
   bool using_datachannel_ = false;
   std::set<std::string> compressed_labels_;
+  // 圧縮するラベル毎の zlib のコンテキスト。メッセージ毎に確保し直さないように使い回す。
+  // ioc のスレッドからのみ触る
+  std::map<std::string, std::unique_ptr<ZlibDeflater>> deflaters_;
+  std::map<std::string, std::unique_ptr<ZlibInflater>> inflaters_;
 
   std::atomic_bool destructed_ = {false};
 
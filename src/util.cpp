@@ -101,6 +101,16 @@ void Util::ParseArgs(int argc,
                "Use libcamera for video capture (only on supported devices)");
   app.add_flag("--use-libcamera-native", args.use_libcamera_native,
                "Use native buffer for H.264 encoding");
+  app.add_option("--v4l2-buffer-count", args.v4l2_buffer_count,
+                 "Number of V4L2 capture buffers (default: 4)")
+      ->check(CLI::Range(2, 32));
+  app.add_flag("--v4l2-zero-copy", args.v4l2_zero_copy,
+               "Pass V4L2 capture buffers to the encoder without copying "
+               "(only on I420/YV12/NV12 devices)");
+  app.add_option("--v4l2-mjpeg-decode-threads", args.v4l2_mjpeg_decode_threads,
+                 "Number of threads to decode MJPEG in software "
+                 "(only for MJPEG with restart markers, default: 1)")
+      ->check(CLI::Range(1, 16));
 
 #if defined(__APPLE__) || defined(_WIN32)
   app.add_option("--video-device", args.video_device,
@@ -158,7 +168,7 @@ void Util::ParseArgs(int argc,
   app.add_flag("--video-codec-engines", video_codecs,
                "List available video encoders/decoders");
   {
-    auto info = VideoCodecInfo::Get();
+    const auto& info = VideoCodecInfo::Get();
     // 長いので短くする
     auto f = [](auto x) {
       return CLI::CheckedTransformer(VideoCodecInfo::GetValidMappingInfo(x),
@@ -188,6 +198,16 @@ void Util::ParseArgs(int argc,
 
   app.add_option("--openh264", args.openh264, "OpenH264 dynamic library path")
       ->check(CLI::ExistingFile);
+  app.add_option("--openh264-threads", args.openh264_threads,
+                 "Maximum number of threads used by OpenH264 encoder "
+                 "(0 means auto)")
+      ->check(CLI::Range(0, 64));
+
+#if defined(USE_VPL_ENCODER)
+  app.add_option("--vpl-async-depth", args.vpl_async_depth,
+                 "Number of frames encoded concurrently by Intel VPL encoder")
+      ->check(CLI::Range(1, 16));
+#endif
 
   auto is_serial_setting_format = CLI::Validator(
       [](std::string input) -> std::string {
@@ -210,12 +230,27 @@ void Util::ParseArgs(int argc,
          "--serial", serial_setting,
          "Serial port settings for datachannel passthrough [DEVICE],[BAUDRATE]")
       ->check(is_serial_setting_format);
+  app.add_option("--serial-framing", args.serial_framing,
+                 "Serial framing: line (newline delimited) or binary "
+                 "(2-byte big-endian length prefix) (default: line)")
+      ->check(CLI::IsMember({"line", "binary"}));
+  app.add_option("--serial-batch-bytes", args.serial_batch_bytes,
+                 "Batch multiple serial lines/frames into one DataChannel "
+                 "message up to this size (default: 0 = disabled)")
+      ->check(CLI::Range(0, 65536));
+  app.add_option("--serial-batch-delay-ms", args.serial_batch_delay_ms,
+                 "Maximum delay before sending a batched message (default: 10)")
+      ->check(CLI::Range(1, 1000));
 
   app.add_option("--metrics-port", args.metrics_port,
                  "Metrics server port number (default: -1)")
       ->check(CLI::Range(-1, 65535));
   app.add_flag("--metrics-allow-external-ip", args.metrics_allow_external_ip,
                "Allow access to Metrics server from external IP");
+  app.add_option("--stats-cache-interval", args.stats_cache_interval,
+                 "Interval in milliseconds to reuse the last WebRTC stats "
+                 "for metrics and pong messages (0 disables, default: 0)")
+      ->check(CLI::Range(0, 60000));
 
   app.add_option("--client-cert", args.client_cert,
                  "Cert file path for client certification (PEM format)")
@@ -293,12 +328,31 @@ void Util::ParseArgs(int argc,
       ->add_option("--spotlight-number", args.sora_spotlight_number,
                    "Stream count delivered in spotlight")
       ->check(CLI::Range(0, 8));
+  sora_app
+      ->add_option("--spotlight-focus-rid", args.sora_spotlight_focus_rid,
+                   "Simulcast rid to receive for focused streams in spotlight")
+      ->check(CLI::IsMember({"", "none", "r0", "r1", "r2"}));
+  sora_app
+      ->add_option("--spotlight-unfocus-rid", args.sora_spotlight_unfocus_rid,
+                   "Simulcast rid to receive for unfocused streams in "
+                   "spotlight")
+      ->check(CLI::IsMember({"", "none", "r0", "r1", "r2"}));
   sora_app->add_option("--port", args.sora_port, "Port number (default: -1)")
       ->check(CLI::Range(-1, 65535));
   sora_app
       ->add_option("--simulcast", args.sora_simulcast,
                    "Use simulcast (default: false)")
       ->transform(CLI::CheckedTransformer(bool_map, CLI::ignore_case));
+  sora_app
+      ->add_option("--simulcast-parallel-encode",
+                   args.sora_simulcast_parallel_encode,
+                   "Encode simulcast layers in parallel when using software "
+                   "encoders (default: false)")
+      ->transform(CLI::CheckedTransformer(bool_map, CLI::ignore_case));
+  sora_app
+      ->add_option("--simulcast-rid", args.sora_simulcast_rid,
+                   "Simulcast rid to receive")
+      ->check(CLI::IsMember({"", "r0", "r1", "r2"}));
   add_optional_bool(sora_app, "--data-channel-signaling",
                     args.sora_data_channel_signaling,
                     "Use DataChannel for Sora signaling (default: none)");
@@ -94,7 +94,19 @@ struct VideoCodecInfo {
     }
   }
 
-  static VideoCodecInfo Get() {
+  static bool Contains(const std::vector<Type>& codecs, Type type) {
+    return std::find(codecs.begin(), codecs.end(), type) != codecs.end();
+  }
+
+  // ハードウェアエンコーダの対応状況を調べるのは CUDA のコンテキストや VPL のセッションを
+  // 作る必要があって時間がかかるので、プロセス内で最初に呼ばれた時に一度だけ調べて、以降はその結果を返す
+  static const VideoCodecInfo& Get() {
+    static const VideoCodecInfo info = Probe();
+    return info;
+  }
+
+ private:
+  static VideoCodecInfo Probe() {
 #if defined(_WIN32)
     return GetWindows();
 #elif defined(__APPLE__)
@@ -104,7 +116,6 @@ struct VideoCodecInfo {
 #endif
   }
 
- private:
 #if defined(_WIN32)
 
   static VideoCodecInfo GetWindows() {
@@ -1,11 +1,134 @@
 #ifndef ZLIB_HELPER_H_
 #define ZLIB_HELPER_H_
 
+#include <string.h>
+
+#include <exception>
 #include <string>
+#include <utility>
 
 // zlib
 #include <zlib.h>
 
+// zlib 形式で圧縮する。
+// z_stream と出力バッファを使い回すので、同じラベルのメッセージを何度も圧縮する場合に
+// 毎回ウィンドウ等を確保し直さずに済む。圧縮結果はメッセージ毎に独立した zlib ストリームになる。
+class ZlibDeflater {
+ public:
+  // dictionary を指定した場合はプリセット辞書を使って圧縮する。
+  // 展開する側にも同じ辞書が必要になる。
+  explicit ZlibDeflater(int level = Z_DEFAULT_COMPRESSION,
+                        std::string dictionary = "")
+      : dictionary_(std::move(dictionary)) {
+    memset(&stream_, 0, sizeof(stream_));
+    if (deflateInit(&stream_, level) != Z_OK) {
+      throw std::exception();
+    }
+  }
+  ~ZlibDeflater() { deflateEnd(&stream_); }
+  ZlibDeflater(const ZlibDeflater&) = delete;
+  ZlibDeflater& operator=(const ZlibDeflater&) = delete;
+
+  // 戻り値は次に Compress を呼ぶまで有効
+  const std::string& Compress(const uint8_t* input_buf, size_t input_size) {
+    if (deflateReset(&stream_) != Z_OK) {
+      throw std::exception();
+    }
+    if (!dictionary_.empty() &&
+        deflateSetDictionary(&stream_, (const Bytef*)dictionary_.data(),
+                             dictionary_.size()) != Z_OK) {
+      throw std::exception();
+    }
+    // deflateBound は 1 回で圧縮しきれるサイズを返すので、出力が足りなくてやり直すことは無い
+    output_.resize(deflateBound(&stream_, input_size));
+    stream_.next_in = (Bytef*)input_buf;
+    stream_.avail_in = input_size;
+    stream_.next_out = (Bytef*)output_.data();
+    stream_.avail_out = output_.size();
+    if (deflate(&stream_, Z_FINISH) != Z_STREAM_END) {
+      throw std::exception();
+    }
+    // 縮める場合は確保済みの領域はそのまま残る
+    output_.resize(stream_.total_out);
+    return output_;
+  }
+  const std::string& Compress(const std::string& input) {
+    return Compress((const uint8_t*)input.data(), input.size());
+  }
+
+ private:
+  z_stream stream_;
+  std::string dictionary_;
+  std::string output_;
+};
+
+// zlib 形式のデータを展開する。
+// ZlibDeflater と同様に z_stream と出力バッファを使い回す。
+class ZlibInflater {
+ public:
+  explicit ZlibInflater(std::string dictionary = "")
+      : dictionary_(std::move(dictionary)) {
+    memset(&stream_, 0, sizeof(stream_));
+    if (inflateInit(&stream_) != Z_OK) {
+      throw std::exception();
+    }
+  }
+  ~ZlibInflater() { inflateEnd(&stream_); }
+  ZlibInflater(const ZlibInflater&) = delete;
+  ZlibInflater& operator=(const ZlibInflater&) = delete;
+
+  // 戻り値は次に Uncompress を呼ぶまで有効
+  const std::string& Uncompress(const uint8_t* input_buf, size_t input_size) {
+    if (inflateReset(&stream_) != Z_OK) {
+      throw std::exception();
+    }
+    if (output_.capacity() < 16 * 1024) {
+      output_.reserve(16 * 1024);
+    }
+    // 前回の出力で確保した領域をそのまま使う
+    output_.resize(output_.capacity());
+    stream_.next_in = (Bytef*)input_buf;
+    stream_.avail_in = input_size;
+    while (true) {
+      stream_.next_out = (Bytef*)output_.data() + stream_.total_out;
+      stream_.avail_out = output_.size() - stream_.total_out;
+      int ret = inflate(&stream_, Z_NO_FLUSH);
+      if (ret == Z_NEED_DICT) {
+        if (dictionary_.empty() ||
+            inflateSetDictionary(&stream_, (const Bytef*)dictionary_.data(),
+                                 dictionary_.size()) != Z_OK) {
+          throw std::exception();
+        }
+        continue;
+      }
+      if (ret == Z_STREAM_END) {
+        break;
+      }
+      if (ret == Z_BUF_ERROR && stream_.avail_in == 0) {
+        // 入力が途中で終わっている
+        throw std::exception();
+      }
+      if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        throw std::exception();
+      }
+      if (stream_.avail_out == 0) {
+        // 展開済みのデータはそのまま残して、続きを書く領域を広げる
+        output_.resize(output_.size() * 2);
+      }
+    }
+    output_.resize(stream_.total_out);
+    return output_;
+  }
+  const std::string& Uncompress(const std::string& input) {
+    return Uncompress((const uint8_t*)input.data(), input.size());
+  }
+
+ private:
+  z_stream stream_;
+  std::string dictionary_;
+  std::string output_;
+};
+
 class ZlibHelper {
  public:
   static std::string Compress(const std::string& input,
@@ -16,24 +139,8 @@ class ZlibHelper {
   static std::string Compress(const uint8_t* input_buf,
                               size_t input_size,
                               int level = Z_DEFAULT_COMPRESSION) {
-    std::string output;
-    output.resize(16 * 1024);
-    uLongf output_size;
-    while (true) {
-      output_size = output.size();
-      int ret = compress2((Bytef*)output.data(), &output_size, input_buf,
-                          input_size, level);
-      if (ret == Z_BUF_ERROR) {
-        output.resize(output.size() * 2);
-        continue;
-      }
-      if (ret != Z_OK) {
-        throw std::exception();
-      }
-      break;
-    }
-    output.resize(output_size);
-    return output;
+    ZlibDeflater deflater(level);
+    return deflater.Compress(input_buf, input_size);
   }
 
   static std::string Uncompress(const std::string& input) {
@@ -41,25 +148,9 @@ class ZlibHelper {
   }
 
   static std::string Uncompress(const uint8_t* input_buf, size_t input_size) {
-    std::string output;
-    output.resize(16 * 1024);
-    uLongf output_size;
-    while (true) {
-      output_size = output.size();
-      int ret = uncompress((Bytef*)output.data(), &output_size, input_buf,
-                           input_size);
-      if (ret == Z_BUF_ERROR) {
-        output.resize(output.size() * 2);
-        continue;
-      }
-      if (ret != Z_OK) {
-        throw std::exception();
-      }
-      break;
-    }
-    output.resize(output_size);
-    return output;
+    ZlibInflater inflater;
+    return inflater.Uncompress(input_buf, input_size);
   }
 };
 
-#endif
\ No newline at end of file
+#endif